@@ -0,0 +1,304 @@
+/*
+Copyright © 2002, University of Tennessee Research Foundation.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the University of Tennessee nor the names of its
+  contributors may be used to endorse or promote products derived from this
+  software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "svdlib.h"
+#include "svdutil.h"
+
+/* Matrices whose smaller dimension is at most this are decomposed densely. */
+#define DENSE_LIMIT 64
+/* Maximum number of Jacobi sweeps for the dense method. */
+#define MAX_SWEEPS  60
+
+extern double eps;
+void   precision(void);
+
+struct batch {
+  SMat *mats;
+  long *order;       /* Matrices, largest first. */
+  SVDRec *R;
+  long dimensions;
+  long iterations;
+  double *end;
+  double kappa;
+  double **work;     /* Per-thread scratch for the dense method. */
+  long *workSize;
+  SVDWorkspace *space; /* Per-thread workspaces for svdLAS2. */
+};
+
+static SVDRec jacobi(SMat A, long dimensions, double **work, long *workSize);
+
+/***********************************************************************
+ *                                                                     *
+ *                        svdLAS2Batch()                               *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   svdLAS2Batch() computes the SVDs of many independent matrices at 
+   once.  Each matrix is one task for the thread pool, handed out 
+   largest first so that the big decompositions do not end up last on 
+   a single thread.  Matrices whose smaller dimension is at most 
+   DENSE_LIMIT are decomposed by one-sided Jacobi on a dense copy, which
+   is faster than a Lanczos run at that size and needs no LAPACK; the 
+   copy lives in scratch space that each thread reuses across tasks.  
+   Likewise each thread's Lanczos runs share one svdLAS2 workspace, so 
+   that it is allocated once per thread rather than once per matrix.
+
+   Each thread's runs are made with SVDBatchRun set, so that they print
+   no reports and ignore SVDCheckpointFile, SVDProgress and SVDOutput, 
+   which they would otherwise share.  The globals themselves are left 
+   alone, so other threads may go on using them.
+
+ ***********************************************************************/
+
+struct size {
+  long vals;
+  long index;
+};
+
+static int largerFirst(const void *a, const void *b) {
+  long x = ((const struct size *) a)->vals, y = ((const struct size *) b)->vals;
+  return (x < y) - (x > y);
+}
+
+static void batchTask(long i, int thread, void *arg) {
+  struct batch *B = (struct batch *) arg;
+  long k = B->order[i];
+  SMat A = B->mats[k];
+  if (!A) return;
+  if (svd_imin(A->rows, A->cols) <= DENSE_LIMIT)
+    B->R[k] = jacobi(A, B->dimensions, &B->work[thread], &B->workSize[thread]);
+  else {
+    SVDWorkspace old;
+    if (!B->space[thread]) B->space[thread] = svdNewWorkspace();
+    old = svdUseWorkspace(B->space[thread]);
+    SVDBatchRun = TRUE;
+    B->R[k] = svdLAS2(A, B->dimensions, B->iterations, B->end, B->kappa);
+    SVDBatchRun = FALSE;
+    svdUseWorkspace(old);
+  }
+}
+
+SVDRec *svdLAS2Batch(SMat *mats, int count, long dimensions, 
+                     long iterations, double end[2], double kappa) {
+  struct batch B;
+  struct size *size;
+  long i;
+  int threads = svd_threads();
+
+  memset(&B, 0, sizeof(B));
+  B.R = (SVDRec *) calloc(count, sizeof(SVDRec));
+  B.order = svd_longArray(count, FALSE, "svdLAS2Batch: order");
+  B.work = (double **) calloc(threads, sizeof(double *));
+  B.workSize = svd_longArray(threads, TRUE, "svdLAS2Batch: workSize");
+  B.space = (SVDWorkspace *) calloc(threads, sizeof(SVDWorkspace));
+  if (!B.R || !B.order || !B.work || !B.workSize || !B.space) {
+    svd_error("svdLAS2Batch: allocation failed");
+    SAFE_FREE(B.R);
+    goto cleanup;
+  }
+  B.mats = mats;
+  B.dimensions = dimensions;
+  B.iterations = iterations;
+  B.end = end;
+  B.kappa = kappa;
+  if (!(size = (struct size *) malloc(count * sizeof(struct size)))) {
+    svd_error("svdLAS2Batch: allocation failed");
+    SAFE_FREE(B.R);
+    goto cleanup;
+  }
+  for (i = 0; i < count; i++) {
+    size[i].vals = (mats[i]) ? mats[i]->vals : -1;
+    size[i].index = i;
+  }
+  qsort(size, count, sizeof(struct size), largerFirst);
+  for (i = 0; i < count; i++) B.order[i] = size[i].index;
+  free(size);
+
+  precision();
+  svd_parallel(count, batchTask, &B);
+
+ cleanup:
+  if (B.work)
+    for (i = 0; i < threads; i++) SAFE_FREE(B.work[i]);
+  SAFE_FREE(B.work);
+  SAFE_FREE(B.workSize);
+  if (B.space)
+    for (i = 0; i < threads; i++) svdFreeWorkspace(B.space[i]);
+  SAFE_FREE(B.space);
+  SAFE_FREE(B.order);
+  return B.R;
+}
+
+/***********************************************************************
+ *                                                                     *
+ *                          jacobi()                                   *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   Function computes the SVD of a small matrix by one-sided (Hestenes)
+   Jacobi rotations.  The matrix is copied densely into W, column by
+   column, transposed if necessary so that it has no more columns (q)
+   than rows (p).  Pairs of columns of W are rotated until all are 
+   mutually orthogonal; the same rotations applied to the identity give
+   V.  The singular values are then the column norms of W, and the 
+   normalized columns are the matching singular vectors.
+
+   Arguments
+   ---------
+
+   (input)
+   A            sparse matrix
+   dimensions   upper limit of desired number of singular triplets
+   work         scratch space, grown as needed and kept by the caller
+
+   (output)
+   R            SVD record holding Ut, S and Vt, or NULL on failure
+
+ ***********************************************************************/
+
+static SVDRec jacobi(SMat A, long dimensions, double **work, long *workSize) {
+  char transpose = (A->cols > A->rows), rotated;
+  long p, q, i, j, k, c, sweep, size, d, *order = NULL;
+  double *W, *V, *sigma, *w, alpha, beta, gamma, zeta, t, cs, sn, x, tol;
+  SVDRec R = NULL;
+
+  p = (transpose) ? A->cols : A->rows;
+  q = (transpose) ? A->rows : A->cols;
+  size = p * q + q * q + q;
+  if (*workSize < size) {
+    SAFE_FREE(*work);
+    if (!(*work = svd_doubleArray(size, FALSE, "jacobi: work"))) {
+      *workSize = 0;
+      return NULL;
+    }
+    *workSize = size;
+  }
+  W = *work;
+  V = W + p * q;
+  sigma = V + q * q;
+  memset(W, 0, (p * q + q * q) * sizeof(double));
+  for (c = 0; c < A->cols; c++)
+    for (k = A->pointr[c]; k < A->pointr[c+1]; k++) {
+      if (transpose) W[A->rowind[k] * p + c] = A->value[k];
+      else W[c * p + A->rowind[k]] = A->value[k];
+    }
+  for (i = 0; i < q; i++) V[i * q + i] = 1.0;
+
+  for (sweep = 0, rotated = TRUE; rotated && sweep < MAX_SWEEPS; sweep++) {
+    rotated = FALSE;
+    for (j = 0; j < q - 1; j++)
+      for (k = j + 1; k < q; k++) {
+        alpha = svd_ddot(p, W + j * p, 1, W + j * p, 1);
+        beta  = svd_ddot(p, W + k * p, 1, W + k * p, 1);
+        gamma = svd_ddot(p, W + j * p, 1, W + k * p, 1);
+        if (fabs(gamma) <= eps * sqrt(alpha * beta)) continue;
+        rotated = TRUE;
+        zeta = (beta - alpha) / (2.0 * gamma);
+        t = svd_fsign(1.0, zeta) / (fabs(zeta) + sqrt(1.0 + zeta * zeta));
+        cs = 1.0 / sqrt(1.0 + t * t);
+        sn = cs * t;
+        for (i = 0, w = W; i < p; i++) {
+          x = w[j * p + i];
+          w[j * p + i] = cs * x - sn * w[k * p + i];
+          w[k * p + i] = sn * x + cs * w[k * p + i];
+        }
+        for (i = 0, w = V; i < q; i++) {
+          x = w[j * q + i];
+          w[j * q + i] = cs * x - sn * w[k * q + i];
+          w[k * q + i] = sn * x + cs * w[k * q + i];
+        }
+      }
+  }
+  if (rotated) 
+    svd_error("jacobi: no convergence after %d sweeps", MAX_SWEEPS);
+
+  /* Order the columns by decreasing norm and drop the null space. */
+  if (!(order = svd_longArray(q, FALSE, "jacobi: order"))) return NULL;
+  for (j = 0; j < q; j++) {
+    sigma[j] = sqrt(svd_ddot(p, W + j * p, 1, W + j * p, 1));
+    order[j] = j;
+  }
+  for (j = 1; j < q; j++)
+    for (k = j; k > 0 && sigma[order[k]] > sigma[order[k-1]]; k--) {
+      i = order[k];
+      order[k] = order[k-1];
+      order[k-1] = i;
+    }
+  tol = (q) ? eps * p * sigma[order[0]] : 0.0;
+  if (dimensions <= 0 || dimensions > q) dimensions = q;
+  for (d = 0; d < dimensions && sigma[order[d]] > tol; d++);
+  if (!d) {
+    svd_error("jacobi: the matrix is zero");
+    SAFE_FREE(order);
+    return NULL;
+  }
+
+  R = svdNewSVDRec();
+  if (!R) goto abort;
+  R->d  = d;
+  R->Ut = svdNewDMat(d, A->rows);
+  R->S  = svd_doubleArray(d, FALSE, "jacobi: R->S");
+  R->Vt = svdNewDMat(d, A->cols);
+  if (!R->Ut || !R->S || !R->Vt) goto abort;
+
+  /* W = U S and A = W V', or A' = W V' if transposed. */
+  for (i = 0; i < d; i++) {
+    j = order[i];
+    R->S[i] = sigma[j];
+    if (transpose) {
+      svd_datx(p, 1.0 / sigma[j], W + j * p, 1, R->Vt->value[i], 1);
+      svd_dcopy(q, V + j * q, 1, R->Ut->value[i], 1);
+    } else {
+      svd_datx(p, 1.0 / sigma[j], W + j * p, 1, R->Ut->value[i], 1);
+      svd_dcopy(q, V + j * q, 1, R->Vt->value[i], 1);
+    }
+  }
+  SAFE_FREE(order);
+  return R;
+
+ abort:
+  svd_error("jacobi: allocation of R failed");
+  svdFreeSVDRec(R);
+  SAFE_FREE(order);
+  return NULL;
+}
@@ -0,0 +1,154 @@
+#!/bin/sh
+# Checks that the multithreaded loaders, converters and transposes give
+# exactly what they give on one thread.  Each matrix is generated, then
+# loaded or converted with -T 1 and with -T $THREADS, writing values
+# exactly, and the two outputs are compared byte for byte.  Run by
+# "make check".
+
+SVD=${SVD:-./svd}
+THREADS=${THREADS:-4}
+DIR=`mktemp -d ${TMPDIR:-/tmp}/svdcheck.XXXXXX` || exit 1
+trap 'rm -rf $DIR' 0
+failed=0
+cases=0
+
+pass() { cases=`expr $cases + 1`; }
+fail() { cases=`expr $cases + 1`; failed=`expr $failed + 1`; echo "FAIL: $*"; }
+
+# Converts $1 (read as $2) to format $3 on 1 and on $THREADS threads, with
+# any further options, and compares the results.
+same() {
+  in=$1; r=$2; w=$3; shift 3
+  $SVD -v 0 -p 0 -T 1 -r $r -w $w "$@" -c "$in" $DIR/one.$w >/dev/null 2>&1
+  e1=$?
+  $SVD -v 0 -p 0 -T $THREADS -r $r -w $w "$@" -c "$in" $DIR/many.$w \
+    >/dev/null 2>&1
+  e2=$?
+  if test $e1 -ne 0 -o $e2 -ne 0; then fail "$in ($r) to $w $*: exit $e1, $e2"
+  elif cmp -s $DIR/one.$w $DIR/many.$w; then pass
+  else fail "$in ($r) to $w $*: outputs differ"; fi
+}
+
+# Writes $1 (read as $2) as format $3 and reads it back as st, comparing 
+# it with $1 written straight to st.
+roundTrip() {
+  in=$1; r=$2; w=$3
+  $SVD -v 0 -p 0 -T $THREADS -r $r -w st -c $in $DIR/ref.st >/dev/null 2>&1 &&
+  $SVD -v 0 -p 0 -T $THREADS -r $r -w $w -c $in $DIR/rt.$w >/dev/null 2>&1 &&
+  $SVD -v 0 -p 0 -T $THREADS -r $w -w st -c $DIR/rt.$w $DIR/rt.st \
+    >/dev/null 2>&1
+  if test $? -ne 0; then fail "$in ($r) through $w: conversion failed"
+  elif cmp -s $DIR/ref.st $DIR/rt.st; then pass
+  else fail "$in ($r) through $w: values changed"; fi
+}
+
+# Strips the final newline.
+noNewline() {
+  awk 'NR > 1 {printf "\n"} {printf "%s", $0}' $1 > $2
+}
+
+cd $DIR || exit 1
+
+# A sparse text file large enough to be parsed in parallel, with some empty
+# columns, and its variants.
+awk 'BEGIN {
+  srand(1); rows = 3000; cols = 2500; vals = 0;
+  for (c = 0; c < cols; c++) {
+    n[c] = 0;
+    if (c % 97)
+      for (r = int(rand() * 100); r < rows; r += 1 + int(rand() * 150)) {
+        e[c, n[c]++] = sprintf("%d %.17g", r, rand() * 2 - 1);
+        vals++;
+      }
+  }
+  print rows, cols, vals;
+  for (c = 0; c < cols; c++) {
+    print n[c];
+    for (i = 0; i < n[c]; i++) print e[c, i];
+  }
+}' > a.st
+sed 's/$/\r/' a.st > crlf.st
+noNewline a.st nonl.st
+# Several values to a line.
+awk 'NR == 1 {print; next} {printf "%s%s", $0, (NR % 3) ? " " : "\n"}
+     END {print ""}' a.st > wrap.st
+
+# A dense text file, with each row wrapped over two lines, and variants.
+awk 'BEGIN {
+  srand(2); rows = 450; cols = 400;
+  print rows, cols;
+  for (r = 0; r < rows; r++)
+    for (c = 0; c < cols; c++)
+      printf "%.17g%s", rand() * 2 - 1,
+             (c == cols - 1 || c == cols / 2) ? "\n" : " ";
+}' > a.dt
+sed 's/$/\r/' a.dt > crlf.dt
+noNewline a.dt nonl.dt
+
+# Matrix Market files: general with duplicate entries, symmetric,
+# skew-symmetric and pattern.
+awk 'BEGIN {
+  srand(3); n = 2000; e = 60000;
+  print "%%MatrixMarket matrix coordinate real general";
+  print "% duplicates are summed";
+  print n, n + 100, e;
+  for (i = 0; i < e; i++) {
+    if (i % 10 == 0 && i) {print r, c, rand(); continue}
+    r = 1 + int(rand() * n); c = 1 + int(rand() * (n + 100));
+    print r, c, rand() * 2 - 1;
+  }
+}' > gen.mm
+for kind in symmetric skew-symmetric; do
+  awk -v kind=$kind 'BEGIN {
+    srand(4); n = 2000; e = 40000;
+    print "%%MatrixMarket matrix coordinate real " kind;
+    print n, n, e;
+    # The lower triangle, without the diagonal if skew.
+    skew = (kind != "symmetric");
+    for (i = 0; i < e; i++) {
+      c = 1 + int(rand() * (n - skew));
+      r = c + skew + int(rand() * (n - c - skew + 1));
+      print r, c, rand() * 2 - 1;
+    }
+  }' > $kind.mm
+done
+awk 'BEGIN {
+  srand(5); n = 2500; e = 50000;
+  print "%%MatrixMarket matrix coordinate pattern general";
+  print n, n, e;
+  for (i = 0; i < e; i++) print 1 + int(rand() * n), 1 + int(rand() * n);
+}' > pattern.mm
+
+# Shards of a.st, laid side by side.
+cp a.st shard1.st
+cp wrap.st shard2.st
+cp nonl.st shard3.st
+
+cd - >/dev/null || exit 1
+for f in a crlf nonl wrap; do
+  for w in st sb2 dt; do same $DIR/$f.st st $w; done
+  same $DIR/$f.st st st -t
+done
+for f in a crlf nonl; do
+  for w in dt st sb2; do same $DIR/$f.dt dt $w; done
+  same $DIR/$f.dt dt dt -t
+done
+for f in gen symmetric skew-symmetric pattern; do
+  for w in st sb2 mm; do same $DIR/$f.mm mm $w; done
+  same $DIR/$f.mm mm st -t
+done
+same "$DIR/shard*.st" st st
+same "$DIR/shard*.st" st dt
+same "$DIR/shard*.st" st sb2 -t
+for w in sb2 db2 npy sbm; do
+  roundTrip $DIR/a.st st $w
+  roundTrip $DIR/gen.mm mm $w
+done
+for w in sb2 db2 npy sbm; do
+  $SVD -v 0 -p 0 -w $w -c $DIR/a.st $DIR/a.$w >/dev/null 2>&1
+  same $DIR/a.$w $w st
+  same $DIR/a.$w $w st -t
+done
+
+echo "$cases checks, $failed failed"
+test $failed -eq 0
@@ -0,0 +1,390 @@
+/*
+Copyright © 2002, University of Tennessee Research Foundation.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+* Neither the name of the University of Tennessee nor the names of its
+  contributors may be used to endorse or promote products derived from this
+  software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "svdlib.h"
+#include "svdutil.h"
+
+/* Machine precision, error flag and tridiagonal solvers from las2.c. */
+extern double eps;
+extern __thread long ierr;
+void   imtqlb(long n, double d[], double e[], double bnd[]);
+void   imtql2(long nm, long n, double d[], double e[], double z[]);
+void   precision(void);
+
+static void   gkl_header(long iterations, long dimensions, double kappa,
+                         long nrow, long ncol, long vals);
+static void   gkl_reorth(long n, long j, double **basis, double *r);
+static long   gkl_bounds(long steps, long dimensions, double kappa,
+                         double *alf, double *bet, double *d, double *e,
+                         double *bnd);
+
+/***********************************************************************
+ *                                                                     *
+ *                        svdGKL()                                     *
+ *     Sparse SVD(A) via Golub-Kahan-Lanczos bidiagonalization         *
+ *                  (double precision)                                 *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   svdGKL() computes singular triplets of A by bidiagonalizing it
+   directly rather than by solving the eigenproblem of A'A.  Starting
+   from a random unit vector v[0], it builds orthonormal bases U (of
+   length m = nrow) and V (of length n = ncol) such that
+
+      A V[k] = U[k] B[k],   A' U[k] = V[k] B[k]' + bet[k-1] v[k] e[k]'
+
+   where B[k] is the k by k upper bidiagonal matrix with diagonal alf
+   and superdiagonal bet.  Each step alternates one multiplication by
+   A and one by A', so the condition number of A is not squared and 
+   the small singular values are resolved to full working accuracy.
+
+   The singular values of B[k] are the positive eigenvalues of the 2k
+   by 2k Golub-Kahan tridiagonal matrix, which has a zero diagonal and
+   the off-diagonal (alf[0], bet[0], alf[1], ..., alf[k-1]).  Its
+   eigenvectors interleave the right and left singular vectors of B[k],
+   so imtql2() yields both at once and Ut and Vt are formed directly
+   from the bases without further multiplications by A.
+
+   Both bases are kept fully orthogonal, so memory use is iterations
+   vectors of length m plus iterations vectors of length n.
+
+
+   Arguments
+   ---------
+
+   (input)
+   A            sparse matrix
+   dimensions   upper limit of desired number of singular triplets of A
+   iterations   upper limit of desired number of Lanczos steps
+   kappa        relative accuracy of singular values acceptable as
+                  converged
+
+   (output)
+   R            SVD record holding Ut, S and Vt, or NULL on failure
+
+
+   Functions used
+   --------------
+
+   BLAS         svd_ddot, svd_dscal, svd_daxpy
+   USER         svd_opa, svd_opat
+   MISC         precision, imtqlb, imtql2, svd_random2
+
+ ***********************************************************************/
+
+SVDRec svdGKL(SMat A, long dimensions, long iterations, double kappa) {
+  long m, n, mn, i, j, k, x, steps = 0;
+  long last, nconv, nsig, irand, idx, js, intro = 0;
+  double **U, **V, *alf = NULL, *bet = NULL, *d = NULL, *e = NULL;
+  double *bnd = NULL, *z = NULL, t, tol = 0.0, anorm = 0.0, reps, eps1;
+  DMat UB = NULL, VB = NULL;
+  SVDRec R = NULL;
+
+  if (!A) {
+    svd_error("svdGKL called with NULL array\n");
+    return NULL;
+  }
+  svdResetCounters();
+
+  m = A->rows;
+  n = A->cols;
+  mn = svd_imin(m, n);
+  if (dimensions <= 0 || dimensions > mn)
+    dimensions = mn;
+  if (iterations <= 0 || iterations > mn)
+    iterations = mn;
+  if (iterations < dimensions) iterations = dimensions;
+
+  if (SVDVerbosity > 0)
+    gkl_header(iterations, dimensions, kappa, m, n, A->vals);
+  if (m <= 0 || n <= 0) {
+    svd_error("svdGKL parameter error: ONE OF YOUR DIMENSIONS IS LESS THAN "
+              "OR EQUAL TO ZERO\n");
+    return NULL;
+  }
+
+  /* Compute machine precision */
+  precision();
+  reps = sqrt(eps);
+  eps1 = eps * sqrt((double) svd_imax(m, n));
+  kappa = svd_dmax(fabs(kappa), reps * sqrt(reps));
+
+  /* Allocate the bases and the bidiagonal. */
+  if (!(UB = svdNewDMat(iterations, m))) goto abort;
+  if (!(VB = svdNewDMat(iterations + 1, n))) goto abort;
+  if (!(alf = svd_doubleArray(iterations, TRUE, "svdGKL: alf"))) goto abort;
+  if (!(bet = svd_doubleArray(iterations, TRUE, "svdGKL: bet"))) goto abort;
+  if (!(d   = svd_doubleArray(2 * iterations, TRUE, "svdGKL: d"))) goto abort;
+  if (!(e   = svd_doubleArray(2 * iterations, TRUE, "svdGKL: e"))) goto abort;
+  if (!(bnd = svd_doubleArray(2 * iterations, TRUE, "svdGKL: bnd"))) 
+    goto abort;
+  U = UB->value;
+  V = VB->value;
+
+  /* Random unit starting vector, seeded as in las2. */
+  irand = 918273;
+  for (i = 0; i < n; i++) V[0][i] = svd_random2(&irand);
+  t = sqrt(svd_ddot(n, V[0], 1, V[0], 1));
+  svd_dscal(n, 1.0 / t, V[0], 1);
+
+  last = svd_imin(dimensions + svd_imax(8, dimensions), iterations);
+  for (j = 0; j < iterations; j++) {
+    /* u[j] = A v[j] - bet[j-1] u[j-1] */
+    svd_opa(A, V[j], U[j]);
+    if (j > 0) svd_daxpy(m, -bet[j-1], U[j-1], 1, U[j], 1);
+    gkl_reorth(m, j, U, U[j]);
+    alf[j] = sqrt(svd_ddot(m, U[j], 1, U[j], 1));
+    anorm = svd_dmax(anorm, alf[j] + ((j > 0) ? bet[j-1] : 0.0));
+    tol = eps1 * anorm;
+    /* A v[j] lies in the span of the previous u: nothing more to find. */
+    if (alf[j] <= tol) break;
+    svd_dscal(m, 1.0 / alf[j], U[j], 1);
+
+    /* v[j+1] = A' u[j] - alf[j] v[j] */
+    svd_opat(A, U[j], V[j+1]);
+    svd_daxpy(n, -alf[j], V[j], 1, V[j+1], 1);
+    gkl_reorth(n, j + 1, V, V[j+1]);
+    bet[j] = sqrt(svd_ddot(n, V[j+1], 1, V[j+1], 1));
+    steps = j + 1;
+    anorm = svd_dmax(anorm, alf[j] + bet[j]);
+    tol = eps1 * anorm;
+    /* An invariant subspace was found: B[k] holds exact triplets. */
+    if (bet[j] <= tol) {
+      bet[j] = 0.0;
+      break;
+    }
+    svd_dscal(n, 1.0 / bet[j], V[j+1], 1);
+
+    /* Check for convergence of the wanted triplets. */
+    if (steps == last) {
+      nconv = gkl_bounds(steps, dimensions, kappa, alf, bet, d, e, bnd);
+      if (ierr) {
+        svd_error("svdGKL: imtqlb failed to converge (ierr = %ld)\n", ierr);
+        goto abort;
+      }
+      if (nconv >= svd_imin(dimensions, steps)) break;
+      if (!nconv) {
+        last = steps + 10;
+        intro = steps;
+      } else last = steps + svd_imax(3, 1 + ((steps - intro) * 
+                                             (dimensions - nconv)) / nconv);
+      last = svd_imin(last, iterations);
+    }
+  }
+  if (steps == 0) {
+    svd_error("svdGKL: the matrix is zero, no singular triplets found");
+    goto abort;
+  }
+  js = 2 * steps;
+
+  /* Final bounds, then the eigenvectors of the Golub-Kahan tridiagonal. */
+  gkl_bounds(steps, dimensions, kappa, alf, bet, d, e, bnd);
+  if (ierr) goto abort;
+  if (!(z = svd_doubleArray(js * js, TRUE, "svdGKL: z"))) goto abort;
+  for (i = 0; i < js * js; i += js + 1) z[i] = 1.0;
+  for (i = 0; i < steps; i++) {
+    d[2*i] = d[2*i+1] = 0.0;
+    e[2*i+1] = alf[i];
+    if (2*i+2 < js) e[2*i+2] = bet[i];
+  }
+  imtql2(js, js, d, e, z);
+  if (ierr) {
+    svd_error("svdGKL: imtql2 failed to converge (ierr = %ld)\n", ierr);
+    goto abort;
+  }
+
+  /* Count the accepted triplets, largest first.  bnd[] is indexed like 
+     the eigenvalues in d[], both in ascending order. */
+  for (nsig = 0, k = js - 1; k >= steps && nsig < dimensions; k--) {
+    if (d[k] <= tol || bnd[k] > kappa * d[k]) break;
+    nsig++;
+  }
+  if (SVDVerbosity > 0) {
+    printf("NUMBER OF LANCZOS STEPS   = %6ld\n"
+           "SINGULAR VALUES FOUND     = %6ld\n", steps, nsig);
+  }
+
+  R = svdNewSVDRec();
+  if (!R) {
+    svd_error("svdGKL: allocation of R failed");
+    goto abort;
+  }
+  R->d  = nsig;
+  R->Ut = svdNewDMat(R->d, m);
+  R->S  = svd_doubleArray(R->d, TRUE, "svdGKL: R->S");
+  R->Vt = svdNewDMat(R->d, n);
+  if (!R->Ut || !R->S || !R->Vt) {
+    svd_error("svdGKL: allocation of R failed");
+    svdFreeSVDRec(R);
+    R = NULL;
+    goto abort;
+  }
+
+  /* Column idx of z interleaves (y[0], x[0], y[1], x[1], ...), each half
+     having norm 1/sqrt(2). */
+  for (x = 0; x < R->d; x++) {
+    idx = js - 1 - x;
+    R->S[x] = d[idx];
+    for (j = 0; j < steps; j++) {
+      svd_daxpy(n, M_SQRT2 * z[(2*j) * js + idx], V[j], 1, R->Vt->value[x], 
+                1);
+      svd_daxpy(m, M_SQRT2 * z[(2*j+1) * js + idx], U[j], 1, 
+                R->Ut->value[x], 1);
+    }
+  }
+
+  if (SVDVerbosity > 1) {
+    printf("\nSINGULAR VALUES: ");
+    svdWriteDenseArray(R->S, R->d, "-", FALSE);
+
+    if (SVDVerbosity > 2) {
+      printf("\nLEFT SINGULAR VECTORS (transpose of U): ");
+      svdWriteDenseMatrix(R->Ut, "-", SVD_F_DT);
+
+      printf("\nRIGHT SINGULAR VECTORS (transpose of V): ");
+      svdWriteDenseMatrix(R->Vt, "-", SVD_F_DT);
+    }
+  }
+
+ abort:
+  if (!R) svd_error("svdGKL: fatal error, aborting");
+  svdFreeDMat(UB);
+  svdFreeDMat(VB);
+  SAFE_FREE(alf);
+  SAFE_FREE(bet);
+  SAFE_FREE(d);
+  SAFE_FREE(e);
+  SAFE_FREE(bnd);
+  SAFE_FREE(z);
+  return R;
+}
+
+/***********************************************************************
+ *                                                                     *
+ *                        gkl_header()                                 *
+ *                                                                     *
+ ***********************************************************************/
+
+static void gkl_header(long iterations, long dimensions, double kappa,
+                       long nrow, long ncol, long vals) {
+  printf("SOLVING THE [A] BIDIAGONAL PROBLEM\n");
+  printf("NO. OF ROWS               = %6ld\n", nrow);
+  printf("NO. OF COLUMNS            = %6ld\n", ncol);
+  printf("NO. OF NON-ZERO VALUES    = %6ld\n", vals);
+  printf("MATRIX DENSITY            = %6.2f%%\n", 
+         ((float) vals / nrow) * 100 / ncol);
+  printf("MAX. NO. OF LANCZOS STEPS = %6ld\n", iterations);
+  printf("MAX. NO. OF TRIPLETS      = %6ld\n", dimensions);
+  printf("KAPPA                     = %9.2E\n", kappa);
+  printf("\n");
+  return;
+}
+
+/***********************************************************************
+ *                                                                     *
+ *                        gkl_reorth()                                 *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   Function orthogonalizes r against basis[0..j-1] by two passes of 
+   modified Gram-Schmidt, which is enough to keep the basis orthogonal
+   to working precision.
+
+ ***********************************************************************/
+
+static void gkl_reorth(long n, long j, double **basis, double *r) {
+  long i, pass;
+  double t;
+  for (pass = 0; pass < 2; pass++)
+    for (i = 0; i < j; i++) {
+      t = svd_ddot(n, basis[i], 1, r, 1);
+      svd_daxpy(n, -t, basis[i], 1, r, 1);
+    }
+}
+
+/***********************************************************************
+ *                                                                     *
+ *                        gkl_bounds()                                 *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   Function computes the singular values of B[steps] and their residual
+   bounds, and returns how many of the wanted (largest) ones have 
+   converged.  The Golub-Kahan tridiagonal is passed to imtqlb() in 
+   reversed order, as lanso() does, so that the returned bnd holds the 
+   last component of each eigenvector.  That component is x[k-1]/sqrt(2)
+   and the residual of the triplet is |A'u - sigma v| = bet[k-1] |x[k-1]|.
+
+   (output)
+   d        eigenvalues in ascending order; the top steps are the
+              singular values of B[steps]
+   bnd      residual bound for each eigenvalue in d
+
+ ***********************************************************************/
+
+static long gkl_bounds(long steps, long dimensions, double kappa,
+                       double *alf, double *bet, double *d, double *e,
+                       double *bnd) {
+  long i, js = 2 * steps, nconv;
+
+  for (i = 0; i < steps; i++) {
+    d[2*i] = d[2*i+1] = 0.0;
+    /* Off-diagonal (alf[0], bet[0], ..., alf[k-1]) reversed into e[1..] */
+    e[js - 1 - 2*i] = alf[i];
+    if (2*i + 1 < js - 1) e[js - 2 - 2*i] = bet[i];
+  }
+  imtqlb(js, d, e, bnd);
+  if (ierr) return 0;
+  for (i = 0; i < js; i++)
+    bnd[i] = M_SQRT2 * bet[steps-1] * fabs(bnd[i]);
+
+  for (nconv = 0, i = js - 1; i >= steps && nconv < dimensions; i--) {
+    if (bnd[i] > kappa * d[i]) break;
+    nconv++;
+  }
+  return nconv;
+}
@@ -35,13 +35,14 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <errno.h>
 #include <math.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include "svdlib.h"
 #include "svdutil.h"
 
 #define MAXLL 2
 
-#define LMTNW   100000000 /* max. size of working area allowed  */
-
 enum storeVals {STORQ = 1, RETRQ, STORP, RETRP};
 
 static char *error_msg[] = {  /* error messages used by function    *
@@ -53,12 +54,67 @@ static char *error_msg[] = {  /* error messages used by function    *
   "ONE OF YOUR DIMENSIONS IS LESS THAN OR EQUAL TO ZERO",
   "NUM ITERATIONS (NUMBER OF LANCZOS STEPS) IS INVALID",
   "REQUESTED DIMENSIONS (NUMBER OF EIGENPAIRS DESIRED) IS INVALID",
-  "6*N+4*ITERATIONS+1 + ITERATIONS*ITERATIONS CANNOT EXCEED NW",
-  "6*N+4*ITERATIONS+1 CANNOT EXCEED NW", NULL};
-
-double **LanStore, *OPBTemp;
-double eps, eps1, reps, eps34;
-long ierr;
+  "PEAK MEMORY USE CANNOT EXCEED THE MEMORY LIMIT", NULL};
+
+/* Solver state is kept per thread so independent SVDs can run at once.  
+   eps is the machine precision, which is set once per process. */
+__thread double **LanStore, *OPBTemp;
+/* All of a run's arrays are carved from one workspace: the calling thread's
+   if svdUseWorkspace gave it one, or otherwise Own, which is freed at the 
+   end of the run.  The Lanczos vectors are iterations + MAXLL slots of 
+   LanStride doubles from LanBase, entered in LanStore when first used. */
+static __thread SVDWorkspace Workspace = NULL;
+static __thread struct svdworkspace Own;
+static __thread double *LanBase;
+static __thread long LanStride;
+__thread double eps1, reps, eps34;
+__thread long ierr;
+double eps;
+static pthread_once_t precisionOnce = PTHREAD_ONCE_INIT;
+
+/* Checkpoint file state, shared by lanso() and lanczos_step().  last and 
+   intro mirror the lanso() variables of the same names. */
+static __thread struct {
+  FILE *file;
+  long interval, iterations;
+  long last, intro;
+  long saved;            /* Step of the latest record. */
+  long savedQ, savedP;   /* Lanczos vectors already in the file. */
+  char resumed;          /* State was restored; lanso() skips stpone(). */
+  long ll;
+  double rnm, tol;
+} Ckpt;
+/* Progress reporting state, shared by svdLAS2(), lanso() and 
+   lanczos_step(). */
+static __thread struct {
+  double *ritz, *bnd;
+  double endl, endr;
+  double start;          /* Wall clock time when svdLAS2() was called. */
+  char cancelled;        /* SVDProgress asked for the run to stop. */
+} Progress;
+/* The package settings a run uses.  svdLAS2Batch runs many at once, which
+   must not share the caller's reports, checkpoint file, progress callback 
+   or sink, so they are turned off for any run on a thread where it has 
+   set SVDBatchRun, leaving the globals themselves alone. */
+__thread char SVDBatchRun = FALSE;
+static __thread struct {
+  long verbosity;
+  char *checkpointFile;
+  SVDProgressFunc progress;
+  SVDSink output;
+} Run;
+/* Set when A is wide.  The run is then made on AA' instead of A'A, 
+   directly over the columns of A, and the roles of U and V are swapped. */
+static __thread char Transposed;
+
+/* Polynomial filter for svdLAS2Smallest().  When degree is nonzero, the 
+   Lanczos run is made on p(A'A), where p is the Chebyshev polynomial of
+   that degree which is 1 at 0 and small on [lower, upper]. */
+static __thread struct {
+  long degree;
+  double lower, upper;
+  double *x, *y, *z;     /* Work vectors for the recurrence. */
+} Filter;
 /*
 double rnm, anorm, tol;
 FILE *fp_out1, *fp_out2;
@@ -76,7 +132,7 @@ void   imtqlb(long n, double d[], double e[], double bnd[]);
 void   write_header(long, long, double, double, long, double, long, long, 
                     long);
 long   check_parameters(SMat A, long dimensions, long iterations, 
-                        double endl, double endr, long vectors);
+                        double endl, double endr, long vectors, long degree);
 int    lanso(SMat A, long iterations, long dimensions, double endl,
              double endr, double *ritz, double *bnd, double *wptr[], 
              long *neigp, long n);
@@ -88,9 +144,24 @@ long   lanczos_step(SMat A, long first, long last, double *wptr[],
                     double *bet, long *ll, long *enough, double *rnmp, 
                     double *tolp, long n);
 void   stpone(SMat A, double *wrkptr[], double *rnmp, double *tolp, long n);
+void   opb(SMat A, double *x, double *y, double *temp);
+void   op_a(SMat A, double *x, double *y);
+void   op_b(SMat A, double *x, double *y, double *temp);
+void   sort_ascending(SVDRec R);
+static SVDRec las2(SMat A, long dimensions, long iterations, double end[2], 
+                   double kappa, long degree);
 long   error_bound(long *, double, double, double *, double *, long step, 
                    double tol);
 void   machar(long *ibeta, long *it, long *irnd, long *machep, long *negep);
+void   precision(void);
+void   checkpoint_open(SMat A, long n, long iterations, long dimensions,
+                       double endl, double endr, double *wptr[]);
+void   checkpoint(long n, long step, double *wptr[], long ll, double rnm,
+                  double tol);
+void   checkpoint_close(char finished);
+void   ritz_bounds(long j, double *alf, double *bet, double *ritz, double *bnd,
+                   double *wrk, double rnm);
+char   progress(long step, double *alf, double *bet, double rnm, double tol);
 
 /***********************************************************************
  *                                                                     *
@@ -218,8 +289,9 @@ void   machar(long *ibeta, long *it, long *irnd, long *machep, long *negep);
  ***********************************************************************/
 
 long check_parameters(SMat A, long dimensions, long iterations, 
-		      double endl, double endr, long vectors) {
+		      double endl, double endr, long vectors, long degree) {
    long error_index;
+   struct svdplan P;
    error_index = 0;
 
    if (endl >/*=*/ endr)  error_index = 2;
@@ -229,6 +301,9 @@ long check_parameters(SMat A, long dimensions, long iterations,
    else if (iterations <= 0 || iterations > A->cols || iterations > A->rows)
      error_index = 5;
    else if (dimensions <= 0 || dimensions > iterations) error_index = 6;
+   else if (SVDMemoryLimit > 0 && 
+            svdPlanLAS2(&P, A->rows, A->cols, A->vals, dimensions, iterations, 
+                        degree, SVDMemoryLimit)) error_index = 7;
    if (error_index) 
      svd_error("svdLAS2 parameter error: %s\n", error_msg[error_index]);
    return(error_index);
@@ -328,11 +403,51 @@ void write_header(long iterations, long dimensions, double endl, double endr,
    Functions used
    --------------
 
-   MISC         svd_dmax, machar, check_parameters
+   MISC         svd_dmax, precision, check_parameters
    LAS2         ritvec, lanso
 
  ***********************************************************************/
 
+/* Places A and the workspace under SVDNumaPolicy.  Partitioned, the 
+   vectors indexed by the columns of A, which the multiplications sum into
+   in strips, are split like A; the rest are interleaved, being read all 
+   over, as the vectors indexed by rows are. */
+static void numaPlace(SMat A, SVDWorkspace W, double **wptr, long slots) {
+  long col[MAX_STRIPS + 1], i;
+  int parts, nodes = svd_numaNodes();
+  double *v[9];
+
+  if (Run.verbosity > 0 && SVDNumaPolicy) {
+    if (nodes < 2) printf("NUMA PLACEMENT            = NONE, ONE NODE\n\n");
+    else printf("NUMA PLACEMENT            = %s OVER %d NODES\n\n", 
+                (SVDNumaPolicy == SVD_NUMA_PARTITION) ? "PARTITIONED" : 
+                "INTERLEAVED", nodes);
+  }
+  if (!SVDNumaPolicy || nodes < 2) return;
+  svd_numaPlaceMatrix(A);
+  svd_numaPlace(W->base, W->used, -1);
+  if (SVDNumaPolicy != SVD_NUMA_PARTITION) return;
+  parts = svd_columnStrips(A, col);
+  if (Transposed) {
+    svd_numaSpread(OPBTemp, sizeof(double), col, parts);
+    return;
+  }
+  for (i = 0; i < 6; i++) v[i] = wptr[i];
+  v[6] = Filter.x;
+  v[7] = Filter.y;
+  v[8] = Filter.z;
+  for (i = 0; i < 9; i++) 
+    if (v[i]) svd_numaSpread(v[i], sizeof(double), col, parts);
+  for (i = 0; i < slots; i++)
+    svd_numaSpread(LanBase + i * LanStride, sizeof(double), col, parts);
+}
+
+SVDWorkspace svdUseWorkspace(SVDWorkspace W) {
+  SVDWorkspace old = Workspace;
+  Workspace = W;
+  return old;
+}
+
 SVDRec svdLAS2A(SMat A, long dimensions) {
   double end[2] = {-1.0e-30, 1.0e-30};
   double kappa = 1e-6;
@@ -346,11 +461,39 @@ SVDRec svdLAS2A(SMat A, long dimensions) {
 
 SVDRec svdLAS2(SMat A, long dimensions, long iterations, double end[2], 
                double kappa) {
-  char transpose = FALSE;
-  long ibeta, it, irnd, machep, negep, n, i, steps, nsig, neig, m;
-  double *wptr[10], *ritz, *bnd;
+  return las2(A, dimensions, iterations, end, kappa, 0);
+}
+
+SVDRec svdLAS2Smallest(SMat A, long dimensions, long iterations, long degree,
+                       double kappa) {
+  double end[2] = {-1.0e-30, 1.0e-30};
+  if (degree <= 0) degree = 20;
+  return las2(A, dimensions, iterations, end, kappa, degree);
+}
+
+static SVDRec las2(SMat A, long dimensions, long iterations, double end[2], 
+                   double kappa, long degree) {
+  long n, i, steps, nsig, neig, m, rows, vec, it, bytes;
+  double *wptr[10], *ritz = NULL, *bnd = NULL;
+  SVDWorkspace W = (Workspace) ? Workspace : &Own;
+  struct timeval tv;
   SVDRec R = NULL;
   ierr = 0;  // reset the global error flag
+  memset(&Run, 0, sizeof(Run));
+  if (!SVDBatchRun) {
+    Run.verbosity = SVDVerbosity;
+    Run.checkpointFile = SVDCheckpointFile;
+    Run.progress = SVDProgress;
+    Run.output = SVDOutput;
+  }
+  
+  for (i = 0; i <= 9; i++) wptr[i] = NULL;
+  LanStore = NULL;
+  OPBTemp = NULL;
+  memset(&Filter, 0, sizeof(Filter));
+  gettimeofday(&tv, NULL);
+  memset(&Progress, 0, sizeof(Progress));
+  Progress.start = tv.tv_sec + tv.tv_usec * 1e-6;
   
   svdResetCounters();
 
@@ -361,80 +504,149 @@ SVDRec svdLAS2(SMat A, long dimensions, long iterations, double end[2],
     iterations = m;
   if (iterations < dimensions) iterations = dimensions;
 
+  /* Take fewer Lanczos steps if that is what it takes to stay within the
+     memory limit. */
+  if (SVDMemoryLimit > 0) {
+    struct svdplan P;
+    svdPlanLAS2(&P, A->rows, A->cols, A->vals, dimensions, iterations, degree,
+                SVDMemoryLimit);
+    if (P.iterations < iterations && Run.verbosity > 0)
+      printf("LANCZOS STEPS LIMITED TO %ld TO FIT IN %ld BYTES\n", 
+             P.iterations, SVDMemoryLimit);
+    iterations = P.iterations;
+  }
+
   /* Write output header */
-  if (SVDVerbosity > 0)
+  if (Run.verbosity > 0)
     write_header(iterations, dimensions, end[0], end[1], TRUE, kappa, A->rows, 
                  A->cols, A->vals);
 
   /* Check parameters */
-  if (check_parameters(A, dimensions, iterations, end[0], end[1], TRUE))
+  if (check_parameters(A, dimensions, iterations, end[0], end[1], TRUE, 
+                       degree))
     return NULL;
 
-  /* If A is wide, the SVD is computed on its transpose for speed. */
-  if (A->cols >= A->rows * 1.2) {
-    if (SVDVerbosity > 0) printf("TRANSPOSING THE MATRIX FOR SPEED\n");
-    transpose = TRUE;
-    A = svdTransposeS(A);
+  /* If A is wide, the SVD is computed on its transpose for speed.  When
+     looking for the smallest values, it must be, since A'A would have 
+     extra zero eigenvalues.  A itself is not transposed. */
+  Transposed = (A->cols >= A->rows * 1.2 || (degree && A->cols > A->rows));
+  if (Transposed) {
+    if (Run.verbosity > 0) printf("TRANSPOSING THE MATRIX FOR SPEED\n");
+    n = A->rows;
+    rows = A->cols;
+  } else {
+    n = A->cols;
+    rows = A->rows;
   }
-
-  n = A->cols;
   /* Compute machine precision */ 
-  machar(&ibeta, &it, &irnd, &machep, &negep);
+  precision();
   eps1 = eps * sqrt((double) n);
   reps = sqrt(eps);
   eps34 = reps * sqrt(reps);
 
-  /* Allocate temporary space. */
-  if (!(wptr[0] = svd_doubleArray(n, TRUE, "las2: wptr[0]"))) goto abort;
-  if (!(wptr[1] = svd_doubleArray(n, FALSE, "las2: wptr[1]"))) goto abort;
-  if (!(wptr[2] = svd_doubleArray(n, FALSE, "las2: wptr[2]"))) goto abort;
-  if (!(wptr[3] = svd_doubleArray(n, FALSE, "las2: wptr[3]"))) goto abort;
-  if (!(wptr[4] = svd_doubleArray(n, FALSE, "las2: wptr[4]"))) goto abort;
-  if (!(wptr[5] = svd_doubleArray(n, FALSE, "las2: wptr[5]"))) goto abort;
-  if (!(wptr[6] = svd_doubleArray(iterations, FALSE, "las2: wptr[6]"))) 
+  /* Size the workspace for everything carved from it below. */
+  vec = SVD_ALIGNED(n * sizeof(double));
+  it = SVD_ALIGNED(iterations * sizeof(double));
+  bytes = (6 + ((degree) ? 3 : 0) + iterations + MAXLL) * vec + 3 * it + 
+    3 * SVD_ALIGNED((iterations + 1) * sizeof(double)) + 
+    SVD_ALIGNED(rows * sizeof(double));
+  if (svd_reserve(W, bytes)) {
+    svd_error("svdLAS2: can't allocate %ld bytes of work space", bytes);
     goto abort;
-  if (!(wptr[7] = svd_doubleArray(iterations, FALSE, "las2: wptr[7]"))) 
+  }
+
+  if (degree) {
+    /* The filter damps the eigenvalues of A'A above their mean, up to an 
+       upper bound on the largest one. */
+    double norm1 = 0.0, normi = 0.0, normf = 0.0, *rowsum;
+    if (!(rowsum = svd_doubleArray(A->rows, TRUE, "las2: rowsum")))
+      goto abort;
+    for (i = 0; i < A->cols; i++) {
+      double colsum = 0.0;
+      long k;
+      for (k = A->pointr[i]; k < A->pointr[i+1]; k++) {
+        colsum += fabs(A->value[k]);
+        rowsum[A->rowind[k]] += fabs(A->value[k]);
+        normf += A->value[k] * A->value[k];
+      }
+      norm1 = svd_dmax(norm1, colsum);
+    }
+    for (i = 0; i < A->rows; i++) normi = svd_dmax(normi, rowsum[i]);
+    SAFE_FREE(rowsum);
+    Filter.degree = degree;
+    Filter.lower = normf / n;
+    Filter.upper = svd_dmin(normf, norm1 * normi);
+    /* If the eigenvalues are all equal, there is nothing to filter. */
+    if (Filter.upper <= Filter.lower * (1.0 + eps34)) Filter.degree = 0;
+    else if (Run.verbosity > 0)
+      printf("CHEBYSHEV FILTER DEGREE   = %6ld\n"
+             "DAMPED INTERVAL           = [%9.2E, %9.2E]\n\n", 
+             degree, Filter.lower, Filter.upper);
+    if (Filter.degree && (!(Filter.x = svd_carve(W, n, FALSE, "las2: Filter.x")) ||
+        !(Filter.y = svd_carve(W, n, FALSE, "las2: Filter.y")) ||
+        !(Filter.z = svd_carve(W, n, FALSE, "las2: Filter.z"))))
+      goto abort;
+  }
+
+  /* Carve out temporary space. */
+  if (!(wptr[0] = svd_carve(W, n, TRUE, "las2: wptr[0]"))) goto abort;
+  if (!(wptr[1] = svd_carve(W, n, FALSE, "las2: wptr[1]"))) goto abort;
+  if (!(wptr[2] = svd_carve(W, n, FALSE, "las2: wptr[2]"))) goto abort;
+  if (!(wptr[3] = svd_carve(W, n, FALSE, "las2: wptr[3]"))) goto abort;
+  if (!(wptr[4] = svd_carve(W, n, FALSE, "las2: wptr[4]"))) goto abort;
+  if (!(wptr[5] = svd_carve(W, n, FALSE, "las2: wptr[5]"))) goto abort;
+  if (!(wptr[6] = svd_carve(W, iterations, FALSE, "las2: wptr[6]"))) 
     goto abort;
-  if (!(wptr[8] = svd_doubleArray(iterations, FALSE, "las2: wptr[8]"))) 
+  if (!(wptr[7] = svd_carve(W, iterations, FALSE, "las2: wptr[7]"))) 
     goto abort;
-  if (!(wptr[9] = svd_doubleArray(iterations + 1, FALSE, "las2: wptr[9]"))) 
+  if (!(wptr[8] = svd_carve(W, iterations, FALSE, "las2: wptr[8]"))) 
     goto abort;
-  /* Calloc may be unnecessary: */
-  if (!(ritz    = svd_doubleArray(iterations + 1, TRUE, "las2: ritz"))) 
+  if (!(wptr[9] = svd_carve(W, iterations + 1, FALSE, "las2: wptr[9]"))) 
+    goto abort;
+  /* Zeroing may be unnecessary: */
+  if (!(ritz    = svd_carve(W, iterations + 1, TRUE, "las2: ritz"))) 
     goto abort;  
-  /* Calloc may be unnecessary: */
-  if (!(bnd     = svd_doubleArray(iterations + 1, TRUE, "las2: bnd"))) 
+  if (!(bnd     = svd_carve(W, iterations + 1, FALSE, "las2: bnd"))) 
     goto abort;
   memset(bnd, 127, (iterations + 1) * sizeof(double));
 
   if (!(LanStore = (double **) calloc(iterations + MAXLL, sizeof(double *))))
     goto abort;
-  if (!(OPBTemp = svd_doubleArray(A->rows, FALSE, "las2: OPBTemp"))) 
+  if (!(OPBTemp = svd_carve(W, rows, FALSE, "las2: OPBTemp"))) 
+    goto abort;
+  LanStride = vec / sizeof(double);
+  if (!(LanBase = svd_carve(W, (iterations + MAXLL) * LanStride, FALSE, 
+                            "las2: LanStore")))
     goto abort;
+  numaPlace(A, W, wptr, iterations + MAXLL);
+
+  /* Pick up an interrupted run, if there is one to resume. */
+  if (Run.checkpointFile)
+    checkpoint_open(A, n, iterations, dimensions, end[0], end[1], wptr);
 
   /* Actually run the lanczos thing: */
+  Progress.ritz = ritz;
+  Progress.bnd = bnd;
+  Progress.endl = end[0];
+  Progress.endr = end[1];
   steps = lanso(A, iterations, dimensions, end[0], end[1], ritz, bnd, wptr, 
                 &neig, n);
+  if (Progress.cancelled) {
+    if (Run.verbosity > 0) printf("CANCELLED AT STEP         = %6ld\n", steps);
+    goto cleanup;
+  }
 
   /* Print some stuff. */
-  if (SVDVerbosity > 0) {
+  if (Run.verbosity > 0) {
     printf("NUMBER OF LANCZOS STEPS   = %6ld\n"
            "RITZ VALUES STABILIZED    = %6ld\n", steps + 1, neig);
   }
-  if (SVDVerbosity > 2) {
+  if (Run.verbosity > 2) {
     printf("\nCOMPUTED RITZ VALUES  (ERROR BNDS)\n");
     for (i = 0; i <= steps; i++)
       printf("%3ld  %22.14E  (%11.2E)\n", i + 1, ritz[i], bnd[i]);
   }
 
-  SAFE_FREE(wptr[0]);
-  SAFE_FREE(wptr[1]);
-  SAFE_FREE(wptr[2]);
-  SAFE_FREE(wptr[3]);
-  SAFE_FREE(wptr[4]);
-  SAFE_FREE(wptr[7]);
-  SAFE_FREE(wptr[8]);
-
   /* Compute eigenvectors */
   kappa = svd_dmax(fabs(kappa), eps34);
   
@@ -444,22 +656,36 @@ SVDRec svdLAS2(SMat A, long dimensions, long iterations, double end[2],
     goto cleanup;
   }
   R->d  = /*svd_imin(nsig, dimensions)*/dimensions;
-  R->Ut = svdNewDMat(R->d, A->rows);
   R->S  = svd_doubleArray(R->d, TRUE, "las2: R->s");
-  R->Vt = svdNewDMat(R->d, A->cols);
-  if (!R->Ut || !R->S || !R->Vt) {
+  /* With SVDOutput, the vectors are passed on instead of kept. */
+  if (!Run.output) {
+    R->Ut = svdNewDMat(R->d, rows);
+    R->Vt = svdNewDMat(R->d, n);
+  }
+  if (!R->S || (!Run.output && (!R->Ut || !R->Vt))) {
     svd_error("svdLAS2: allocation of R failed");
     goto cleanup;
   }
 
   nsig = ritvec(n, A, R, kappa, ritz, bnd, wptr[6], wptr[9], wptr[5], steps, 
                 neig);
+  /* Triples already passed to Run.output stay in the order found. */
+  if (degree && !Run.output) sort_ascending(R);
+  /* If the vectors couldn't be formed, the Lanczos run is kept for the 
+     next attempt. */
+  checkpoint_close(!ierr);
+  if (ierr) {
+    svd_error("svdLAS2: failed to find the singular vectors");
+    svdFreeSVDRec(R);
+    R = NULL;
+    goto cleanup;
+  }
   
-  if (SVDVerbosity > 1) {
+  if (Run.verbosity > 1) {
     printf("\nSINGULAR VALUES: ");
     svdWriteDenseArray(R->S, R->d, "-", FALSE);
 
-    if (SVDVerbosity > 2) {
+    if (Run.verbosity > 2 && !Run.output) {
       printf("\nLEFT SINGULAR VECTORS (transpose of U): ");
       svdWriteDenseMatrix(R->Ut, "-", SVD_F_DT);
 
@@ -467,36 +693,31 @@ SVDRec svdLAS2(SMat A, long dimensions, long iterations, double end[2],
       svdWriteDenseMatrix(R->Vt, "-", SVD_F_DT);
     }
   }
-  if (SVDVerbosity > 0) {
+  if (Run.verbosity > 0) {
     printf("SINGULAR VALUES FOUND     = %6d\n"
 	   "SIGNIFICANT VALUES        = %6ld\n", R->d, nsig);
   }
 
  cleanup:    
-  for (i = 0; i <= 9; i++)
-    SAFE_FREE(wptr[i]);
-  SAFE_FREE(ritz);
-  SAFE_FREE(bnd);
-  if (LanStore) {
-    for (i = 0; i < iterations + MAXLL; i++)
-      SAFE_FREE(LanStore[i]);
-    SAFE_FREE(LanStore);
-  }
-  SAFE_FREE(OPBTemp);
+  checkpoint_close(FALSE);
+  SAFE_FREE(LanStore);
+  OPBTemp = LanBase = NULL;
+  memset(&Filter, 0, sizeof(Filter));
+  if (W == &Own) svd_release(W);
 
   /* This swaps and transposes the singular matrices if A was transposed. */
-  if (R && transpose) {
+  if (R && Transposed) {
     DMat T;
-    svdFreeSMat(A);
     T = R->Ut;
     R->Ut = R->Vt;
     R->Vt = T;
   }
 
+  Transposed = FALSE;
   return R;
 abort:
   svd_error("svdLAS2: fatal error, aborting");
-  return NULL;
+  goto cleanup;
 }
 
 
@@ -513,7 +734,8 @@ abort:
 
    This function is invoked by landr() only if eigenvectors of the A'A
    eigenproblem are desired.  When called, ritvec() computes the 
-   singular vectors of A and writes the result to an unformatted file.
+   singular vectors of A and stores them in R, or, if SVDOutput is set, 
+   passes each triple to it as soon as it is computed.
 
 
    Parameters
@@ -533,7 +755,7 @@ abort:
    w1, w2     work space
 
    (output)
-   xv1        array of eigenvectors of A'A (right singular vectors of A)
+   R          the singular values, and unless SVDOutput is set, vectors
    ierr	      error code
               0 for normal return from imtql2()
 	      k if convergence did not occur for k-th eigenvalue in
@@ -555,36 +777,27 @@ abort:
 
  ***********************************************************************/
 
-void rotateArray(double *a, int size, int x) {
-  int i, j, n, start;
-  double t1, t2;
-  if (x == 0) return;
-  j = start = 0;
-  t1 = a[0];
-  for (i = 0; i < size; i++) {
-    n = (j >= x) ? j - x : j + size - x;
-    t2 = a[n];
-    a[n] = t1;
-    t1 = t2;
-    j = n;
-    if (j == start) {
-      start = ++j;
-      t1 = a[j];
-    }
-  }
-}
-
 long ritvec(long n, SMat A, SVDRec R, double kappa, double *ritz, double *bnd, 
             double *alf, double *bet, double *w2, long steps, long neig) {
-  long js, jsq, i, k, /*size,*/ id2, tmp, nsig, x;
-  double *s, *xv2, tmp0, tmp1, xnorm, *w1 = R->Vt->value[0];
+  long js, jsq, i, k, tmp, nsig = 0, x, rows, *keep = NULL;
+  double *s, *xv2, *w1, *u = NULL, *v = NULL, tmp0, tmp1;
   
   js = steps + 1;
   jsq = js * js;
-  /*size = sizeof(double) * n;*/
+  rows = (Transposed) ? A->cols : A->rows;
   
   s = svd_doubleArray(jsq, TRUE, "ritvec: s");
   xv2 = svd_doubleArray(n, FALSE, "ritvec: xv2");
+  w1 = svd_doubleArray(js, FALSE, "ritvec: w1");
+  keep = svd_longArray(js, FALSE, "ritvec: keep");
+  if (Run.output) {
+    u = svd_doubleArray(rows, FALSE, "ritvec: u");
+    v = svd_doubleArray(n, FALSE, "ritvec: v");
+  }
+  if (!s || !xv2 || !w1 || !keep || (Run.output && (!u || !v))) {
+    ierr = 1;
+    goto done;
+  }
   
   /* initialize s to an identity matrix */
   for (i = 0; i < jsq; i+= (js+1)) s[i] = 1.0;
@@ -594,74 +807,70 @@ long ritvec(long n, SMat A, SVDRec R, double kappa, double *ritz, double *bnd,
   /* on return from imtql2(), w1 contains eigenvalues in ascending 
    * order and s contains the corresponding eigenvectors */
   imtql2(js, js, w1, w2, s);
+  if (ierr) goto done;
   
-  /*fwrite((char *)&n, sizeof(n), 1, fp_out2);
-    fwrite((char *)&js, sizeof(js), 1, fp_out2);
-    fwrite((char *)&kappa, sizeof(kappa), 1, fp_out2);*/
-  /*id = 0;*/
-  nsig = 0;
+  /* The accepted ritz values are in increasing order, and the d largest
+     of them are wanted, largest first. */
+  for (k = 0; k < js; k++)
+    if (bnd[k] <= kappa * fabs(ritz[k]) && k > js-neig-1) keep[nsig++] = k;
+  R->d = svd_imin(R->d, nsig);
+  if (Run.output && Run.output->begin && 
+      Run.output->begin(Run.output, R->d, (Transposed) ? n : rows, 
+                       (Transposed) ? rows : n)) {
+    svd_error("ritvec: output failed");
+    ierr = 1;
+    goto done;
+  }
 
-  if (ierr) {
-    R->d = 0;
-  } else {
-    x = 0;
-    id2 = jsq - js;
-    for (k = 0; k < js; k++) {
-      tmp = id2;
-      if (bnd[k] <= kappa * fabs(ritz[k]) && k > js-neig-1) {
-	if (--x < 0) x = R->d - 1;
-	w1 = R->Vt->value[x];
-	for (i = 0; i < n; i++) w1[i] = 0.0;
-	for (i = 0; i < js; i++) {
-	  store(n, RETRQ, i, w2);
-	  svd_daxpy(n, s[tmp], w2, 1, w1, 1);
-	  tmp -= js;
-	}
-	/*fwrite((char *)w1, size, 1, fp_out2);*/
-      
-	/* store the w1 vector row-wise in array xv1;   
-	 * size of xv1 is (steps+1) * (nrow+ncol) elements 
-	 * and each vector, even though only ncol long,
-	 * will have (nrow+ncol) elements in xv1.      
-	 * It is as if xv1 is a 2-d array (steps+1) by     
-	 * (nrow+ncol) and each vector occupies a row  */
-
-	/* j is the index in the R arrays, which are sorted by high to low 
-	   singular values. */
-        
-	/*for (i = 0; i < n; i++) R->Vt->value[x]xv1[id++] = w1[i];*/
-	/*id += nrow;*/
-	nsig++;
-      }
-      id2++;
+  /* Each triple is finished in turn, so that with SVDOutput only one pair 
+     of vectors need be held at a time. */
+  for (x = 0; x < R->d; x++) {
+    k = keep[nsig - 1 - x];
+    if (!Run.output) {
+      v = R->Vt->value[x];
+      u = R->Ut->value[x];
     }
-    SAFE_FREE(s);
-
-    /* Rotate the singular vectors and values. */
-    /* x is now the location of the highest singular value. */
-    rotateArray(R->Vt->value[0], R->Vt->rows * R->Vt->cols, 
-		x * R->Vt->cols);
-    R->d = svd_imin(R->d, nsig);
-    for (x = 0; x < R->d; x++) {
-      /* multiply by matrix B first */
-      svd_opb(A, R->Vt->value[x], xv2, OPBTemp);
-      tmp0 = svd_ddot(n, R->Vt->value[x], 1, xv2, 1);
-      svd_daxpy(n, -tmp0, R->Vt->value[x], 1, xv2, 1);
-      tmp0 = sqrt(tmp0);
-      xnorm = sqrt(svd_ddot(n, xv2, 1, xv2, 1));
+    /* The right vector is the Lanczos vectors combined by the eigenvector
+       of T, which is column k of s. */
+    for (i = 0; i < n; i++) v[i] = 0.0;
+    for (i = 0, tmp = jsq - js + k; i < js; i++, tmp -= js) {
+      store(n, RETRQ, i, w2);
+      svd_daxpy(n, s[tmp], w2, 1, v, 1);
+    }
+
+    /* multiply by matrix B first */
+    op_b(A, v, xv2, OPBTemp);
+    tmp0 = sqrt(svd_ddot(n, v, 1, xv2, 1));
       
-      /* multiply by matrix A to get (scaled) left s-vector */
-      svd_opa(A, R->Vt->value[x], R->Ut->value[x]);
-      tmp1 = 1.0 / tmp0;
-      svd_dscal(A->rows, tmp1, R->Ut->value[x], 1);
-      xnorm *= tmp1;
-      bnd[i] = xnorm;
-      R->S[x] = tmp0;
+    /* multiply by matrix A to get (scaled) left s-vector */
+    op_a(A, v, u);
+    tmp1 = 1.0 / tmp0;
+    svd_dscal(rows, tmp1, u, 1);
+    R->S[x] = tmp0;
+
+    if (Run.output && Run.output->triple(Run.output, x, tmp0, 
+                                       (Transposed) ? v : u,
+                                       (Transposed) ? u : v)) {
+      svd_error("ritvec: output failed");
+      ierr = 1;
+      break;
     }
   }
+  if (Run.output && !ierr && Run.output->end && Run.output->end(Run.output)) {
+    svd_error("ritvec: output failed");
+    ierr = 1;
+  }
 
+ done:
+  if (ierr) R->d = 0;
   SAFE_FREE(s);
   SAFE_FREE(xv2);
+  SAFE_FREE(w1);
+  SAFE_FREE(keep);
+  if (Run.output) {
+    SAFE_FREE(u);
+    SAFE_FREE(v);
+  }
   return nsig;
 }
 
@@ -713,7 +922,7 @@ long ritvec(long n, SMat A, SVDRec R, double kappa, double *ritz, double *bnd,
    Functions used
    --------------
 
-   LAS		stpone, error_bound, lanczos_step
+   LAS		stpone, error_bound, lanczos_step, ritz_bounds
    MISC		svd_dsort2
    UTILITY	svd_imin, svd_imax
 
@@ -723,7 +932,7 @@ int lanso(SMat A, long iterations, long dimensions, double endl,
           double endr, double *ritz, double *bnd, double *wptr[], 
           long *neigp, long n) {
   double *alf, *eta, *oldeta, *bet, *wrk, rnm, tol;
-  long ll, first, last, ENOUGH, id2, id3, i, l, neig, j = 0, intro = 0;
+  long ll, first, last, ENOUGH, neig, j = 0, intro = 0;
   
   alf = wptr[6];
   eta = wptr[7];
@@ -731,51 +940,42 @@ int lanso(SMat A, long iterations, long dimensions, double endl,
   bet = wptr[9];
   wrk = wptr[5];
   
-  /* take the first step */
-  stpone(A, wptr, &rnm, &tol, n);
-  if (!rnm || ierr) return 0;
-  eta[0] = eps1;
-  oldeta[0] = eps1;
-  ll = 0;
-  first = 1;
-  last = svd_imin(dimensions + svd_imax(8, dimensions), iterations);
+  if (Ckpt.resumed) {
+    /* continue from the step saved in the checkpoint file */
+    first = Ckpt.saved;
+    last = Ckpt.last;
+    intro = Ckpt.intro;
+    ll = Ckpt.ll;
+    rnm = Ckpt.rnm;
+    tol = Ckpt.tol;
+  } else {
+    /* take the first step */
+    stpone(A, wptr, &rnm, &tol, n);
+    if (!rnm || ierr) return 0;
+    eta[0] = eps1;
+    oldeta[0] = eps1;
+    ll = 0;
+    first = 1;
+    last = svd_imin(dimensions + svd_imax(8, dimensions), iterations);
+  }
   ENOUGH = FALSE;
   /*id1 = 0;*/
   while (/*id1 < dimensions && */!ENOUGH) {
     if (rnm <= tol) rnm = 0.0;
     
     /* the actual lanczos loop */
+    Ckpt.last = last;
+    Ckpt.intro = intro;
     j = lanczos_step(A, first, last, wptr, alf, eta, oldeta, bet, &ll,
                      &ENOUGH, &rnm, &tol, n);
+    if (Progress.cancelled) return j;
     if (ENOUGH) j = j - 1;
     else j = last - 1;
     first = j + 1;
     bet[j+1] = rnm;
     
     /* analyze T */
-    l = 0;
-    for (id2 = 0; id2 < j; id2++) {
-      if (l > j) break;
-      for (i = l; i <= j; i++) if (!bet[i+1]) break;
-      if (i > j) i = j;
-      
-      /* now i is at the end of an unreduced submatrix */
-      svd_dcopy(i-l+1, &alf[l],   1, &ritz[l],  -1);
-      svd_dcopy(i-l,   &bet[l+1], 1, &wrk[l+1], -1);
-      
-      imtqlb(i-l+1, &ritz[l], &wrk[l], &bnd[l]);
-      
-      if (ierr) {
-        svd_error("svdLAS2: imtqlb failed to converge (ierr = %ld)\n", ierr);
-        svd_error("  l = %ld  i = %ld\n", l, i);
-        for (id3 = l; id3 <= i; id3++) 
-          svd_error("  %ld  %lg  %lg  %lg\n", 
-                    id3, ritz[id3], wrk[id3], bnd[id3]);
-      }
-      for (id3 = l; id3 <= i; id3++) 
-        bnd[id3] = rnm * fabs(bnd[id3]);
-      l = i + 1;
-    }
+    ritz_bounds(j, alf, bet, ritz, bnd, wrk, rnm);
     
     /* sort eigenvalues into increasing order */
     svd_dsort2((j+1) / 2, j + 1, ritz, bnd);
@@ -852,6 +1052,15 @@ long lanczos_step(SMat A, long first, long last, double *wptr[],
    long i, j;
 
    for (j=first; j<last; j++) {
+      if (Ckpt.file && j % Ckpt.interval == 0 && j != Ckpt.saved)
+        checkpoint(n, j, wptr, *ll, rnm, tol);
+      if (Run.progress && SVDProgressInterval > 0 && 
+          j % SVDProgressInterval == 0 &&
+          progress(j, alf, bet, rnm, tol)) {
+        *enough = TRUE;
+        break;
+      }
+
       mid     = wptr[2];
       wptr[2] = wptr[1];
       wptr[1] = mid;
@@ -883,7 +1092,7 @@ long lanczos_step(SMat A, long first, long last, double *wptr[],
       t = 1.0 / rnm;
       svd_datx(n, t, wptr[0], 1, wptr[1], 1);
       svd_dscal(n, t, wptr[3], 1);
-      svd_opb(A, wptr[3], wptr[0], OPBTemp);
+      opb(A, wptr[3], wptr[0], OPBTemp);
       svd_daxpy(n, -rnm, wptr[2], 1, wptr[0], 1);
       alf[j] = svd_ddot(n, wptr[0], 1, wptr[3], 1);
       svd_daxpy(n, -alf[j], wptr[1], 1, wptr[0], 1);
@@ -1127,7 +1336,7 @@ void stpone(SMat A, double *wrkptr[], double *rnmp, double *tolp, long n) {
    svd_dscal(n, t, wrkptr[3], 1);
 
    /* take the first step */
-   svd_opb(A, wrkptr[3], wrkptr[0], OPBTemp);
+   opb(A, wrkptr[3], wrkptr[0], OPBTemp);
    alf[0] = svd_ddot(n, wrkptr[0], 1, wrkptr[3], 1);
    svd_daxpy(n, -alf[0], wrkptr[1], 1, wrkptr[0], 1);
    t = svd_ddot(n, wrkptr[0], 1, wrkptr[3], 1);
@@ -1194,7 +1403,7 @@ double startv(SMat A, double *wptr[], long step, long n) {
       svd_dcopy(n, wptr[0], 1, wptr[3], 1);
 
       /* apply operator to put r in range (essential if m singular) */
-      svd_opb(A, wptr[3], wptr[0], OPBTemp);
+      opb(A, wptr[3], wptr[0], OPBTemp);
       svd_dcopy(n, wptr[0], 1, wptr[3], 1);
       rnm2 = svd_ddot(n, wptr[0], 1, wptr[3], 1);
       if (rnm2 > 0.0) break;
@@ -1726,6 +1935,22 @@ void machar(long *ibeta, long *it, long *irnd, long *machep, long *negep) {
   return;
 }
 
+/***********************************************************************
+ *                                                                     *
+ *                        precision()                                  *
+ *          Sets eps by calling machar() once per process              *
+ *                                                                     *
+ ***********************************************************************/
+
+static void precisionInit(void) {
+  long ibeta, it, irnd, machep, negep;
+  machar(&ibeta, &it, &irnd, &machep, &negep);
+}
+
+void precision(void) {
+  pthread_once(&precisionOnce, precisionInit);
+}
+
 /***********************************************************************
  *                                                                     *
  *                     store()                                         *
@@ -1762,15 +1987,17 @@ void machar(long *ibeta, long *it, long *irnd, long *machep, long *negep) {
 
  ***********************************************************************/
 
+/* Enters slot j of the Lanczos vectors in LanStore. */
+static double *lanVector(long j) {
+  if (!LanStore[j]) LanStore[j] = LanBase + j * LanStride;
+  return LanStore[j];
+}
+
 void store(long n, long isw, long j, double *s) {
   /* printf("called store %ld %ld\n", isw, j); */
   switch(isw) {
   case STORQ:
-    if (!LanStore[j + MAXLL]) {
-      if (!(LanStore[j + MAXLL] = svd_doubleArray(n, FALSE, "LanStore[j]")))
-        svd_fatalError("svdLAS2: failed to allocate LanStore[%d]", j + MAXLL);
-    }
-    svd_dcopy(n, s, 1, LanStore[j + MAXLL], 1);
+    svd_dcopy(n, s, 1, lanVector(j + MAXLL), 1);
     break;
   case RETRQ:	
     if (!LanStore[j + MAXLL])
@@ -1783,11 +2010,7 @@ void store(long n, long isw, long j, double *s) {
       svd_error("svdLAS2: store (STORP) called with j >= MAXLL");
       break;
     }
-    if (!LanStore[j]) {
-      if (!(LanStore[j] = svd_doubleArray(n, FALSE, "LanStore[j]")))
-        svd_fatalError("svdLAS2: failed to allocate LanStore[%d]", j);
-    }
-    svd_dcopy(n, s, 1, LanStore[j], 1);
+    svd_dcopy(n, s, 1, lanVector(j), 1);
     break;
   case RETRP:	
     if (j >= MAXLL) {
@@ -1802,3 +2025,591 @@ void store(long n, long isw, long j, double *s) {
   }
   return;
 }
+
+/***********************************************************************
+ *                                                                     *
+ *                     checkpoint_open()                               *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   The checkpoint file lets a long Lanczos run survive being killed.  It
+   starts with a header identifying the problem, followed by records 
+   appended every SVDCheckpointInterval steps.  Each record holds the 
+   Lanczos vectors stored since the previous record (so the file grows
+   by only the new basis vectors), followed by the complete recurrence 
+   state at the top of lanczos_step() for that step: alf, bet, eta, 
+   oldeta, the work vectors wptr[0..4], ll, rnm, tol, and the lanso()
+   variables last and intro.  Starting vectors need no saved seed, as 
+   startv() seeds random2 from the step number.  A record ends with a 
+   marker, so one cut short by the process dying is ignored and 
+   overwritten.
+
+   checkpoint_open() is called by svdLAS2() before lanso().  If 
+   SVDCheckpointFile holds records for the same matrix and parameters,
+   it restores the latest one into wptr[] and LanStore and sets 
+   Ckpt.resumed; otherwise it starts a new file.  Problems with the file
+   are reported and the run continues without checkpoints.
+
+   The records use the native binary layout and are only meant to be 
+   read back on the same kind of machine.
+
+ ***********************************************************************/
+
+#define CKPT_MAGIC  "SVDCKPT1"
+#define CKPT_RECORD 0x5245434fL
+#define CKPT_END    0x454e4421L
+
+struct ckptHeader {
+  char magic[8];
+  long rows, cols, vals, n, iterations, dimensions, degree;
+  double endl, endr, checksum;
+};
+
+struct ckptRecord {
+  long tag;
+  long step, last, intro, ll;
+  double rnm, tol;
+  long qFrom, qTo, pFrom, pTo;  /* Lanczos vectors stored in this record. */
+};
+
+static char ckptRead(FILE *file, double *a, long n) {
+  return (fread(a, sizeof(double), n, file) != (size_t) n);
+}
+
+static char ckptWrite(FILE *file, double *a, long n) {
+  return (fwrite(a, sizeof(double), n, file) != (size_t) n);
+}
+
+static void ckptReset(long iterations) {
+  memset(&Ckpt, 0, sizeof(Ckpt));
+  Ckpt.saved = -1;
+  Ckpt.iterations = iterations;
+  Ckpt.interval = (SVDCheckpointInterval > 0) ? SVDCheckpointInterval : 100;
+}
+
+void checkpoint_open(SMat A, long n, long iterations, long dimensions,
+                     double endl, double endr, double *wptr[]) {
+  struct ckptHeader H, F;
+  struct ckptRecord rec;
+  long i, good = 0, state = 0, tag;
+  FILE *file;
+
+  ckptReset(iterations);
+  memset(&H, 0, sizeof(H));
+  memcpy(H.magic, CKPT_MAGIC, 8);
+  H.rows = A->rows;
+  H.cols = A->cols;
+  H.vals = A->vals;
+  H.n = n;
+  H.iterations = iterations;
+  H.dimensions = dimensions;
+  H.degree = Filter.degree;
+  H.endl = endl;
+  H.endr = endr;
+  for (i = 0; i < A->vals; i++) 
+    H.checksum += A->value[i] * (A->rowind[i] % 31 + 1);
+
+  if ((file = fopen(Run.checkpointFile, "r+b"))) {
+    if (fread(&F, sizeof(F), 1, file) == 1 && !memcmp(&F, &H, sizeof(H))) {
+      /* Take in the vectors of each complete record, noting where the 
+         state of the latest one starts. */
+      while (fread(&rec, sizeof(rec), 1, file) == 1 && rec.tag == CKPT_RECORD
+             && rec.qFrom == Ckpt.savedQ && rec.pFrom == Ckpt.savedP &&
+             rec.qTo <= iterations && rec.pTo <= MAXLL) {
+        for (i = rec.qFrom; i < rec.qTo; i++)
+          if (ckptRead(file, lanVector(i + MAXLL), n)) break;
+        if (i < rec.qTo) break;
+        for (i = rec.pFrom; i < rec.pTo; i++)
+          if (ckptRead(file, lanVector(i), n)) break;
+        if (i < rec.pTo) break;
+        i = ftell(file);
+        fseek(file, (4 * iterations + 1 + 5 * n) * sizeof(double), SEEK_CUR);
+        if (fread(&tag, sizeof(long), 1, file) != 1 || tag != CKPT_END) break;
+
+        good = ftell(file);
+        state = i;
+        Ckpt.saved = rec.step;
+        Ckpt.last = rec.last;
+        Ckpt.intro = rec.intro;
+        Ckpt.ll = rec.ll;
+        Ckpt.rnm = rec.rnm;
+        Ckpt.tol = rec.tol;
+        Ckpt.savedQ = rec.qTo;
+        Ckpt.savedP = rec.pTo;
+      }
+    } else if (Run.verbosity > 0)
+      printf("CHECKPOINT %s IS FOR ANOTHER PROBLEM, STARTING OVER\n", 
+             Run.checkpointFile);
+
+    if (good) {
+      fseek(file, state, SEEK_SET);
+      if (ckptRead(file, wptr[6], iterations) || 
+          ckptRead(file, wptr[7], iterations) ||
+          ckptRead(file, wptr[8], iterations) || 
+          ckptRead(file, wptr[9], iterations + 1)) good = 0;
+      for (i = 0; good && i < 5; i++)
+        if (ckptRead(file, wptr[i], n)) good = 0;
+      /* Drop any partial record after the last good one. */
+      if (good && (ftruncate(fileno(file), good) || 
+                   fseek(file, good, SEEK_SET))) good = 0;
+    }
+    if (good) Ckpt.resumed = TRUE;
+    else {
+      fclose(file);
+      file = NULL;
+    }
+  }
+
+  if (!file) {
+    ckptReset(iterations);
+    for (i = 0; i < iterations + MAXLL; i++) LanStore[i] = NULL;
+    /* stpone() takes a nonzero wptr[0] as its starting vector. */
+    memset(wptr[0], 0, n * sizeof(double));
+    if (!(file = fopen(Run.checkpointFile, "w+b")) || 
+        fwrite(&H, sizeof(H), 1, file) != 1 || fflush(file)) {
+      svd_error("svdLAS2: can't write checkpoint file %s, continuing "
+                "without it", Run.checkpointFile);
+      if (file) fclose(file);
+      return;
+    }
+  }
+  Ckpt.file = file;
+  if (Ckpt.resumed && Run.verbosity > 0)
+    printf("RESUMING FROM STEP        = %6ld\n", Ckpt.saved);
+}
+
+/***********************************************************************
+ *                                                                     *
+ *                        checkpoint()                                 *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   Function appends a record to the checkpoint file, as described under
+   checkpoint_open(), for the state at the top of lanczos_step() when it
+   is about to take step.  The record is flushed to disk before 
+   returning.  If writing fails, checkpointing is turned off.
+
+ ***********************************************************************/
+
+void checkpoint(long n, long step, double *wptr[], long ll, double rnm,
+                double tol) {
+  struct ckptRecord rec;
+  long i, iterations = Ckpt.iterations, tag = CKPT_END;
+  FILE *file = Ckpt.file;
+
+  rec.tag = CKPT_RECORD;
+  rec.step = step;
+  rec.last = Ckpt.last;
+  rec.intro = Ckpt.intro;
+  rec.ll = ll;
+  rec.rnm = rnm;
+  rec.tol = tol;
+  /* q[0..step-2] and p[0..step-2] have been stored so far. */
+  rec.qFrom = Ckpt.savedQ;
+  rec.qTo = step - 1;
+  rec.pFrom = Ckpt.savedP;
+  rec.pTo = svd_imin(step - 1, MAXLL);
+
+  if (fwrite(&rec, sizeof(rec), 1, file) != 1) goto fail;
+  for (i = rec.qFrom; i < rec.qTo; i++)
+    if (ckptWrite(file, LanStore[i + MAXLL], n)) goto fail;
+  for (i = rec.pFrom; i < rec.pTo; i++)
+    if (ckptWrite(file, LanStore[i], n)) goto fail;
+  if (ckptWrite(file, wptr[6], iterations) || 
+      ckptWrite(file, wptr[7], iterations) ||
+      ckptWrite(file, wptr[8], iterations) || 
+      ckptWrite(file, wptr[9], iterations + 1)) goto fail;
+  for (i = 0; i < 5; i++)
+    if (ckptWrite(file, wptr[i], n)) goto fail;
+  if (fwrite(&tag, sizeof(long), 1, file) != 1) goto fail;
+  if (fflush(file) || fsync(fileno(file))) goto fail;
+
+  Ckpt.saved = step;
+  Ckpt.savedQ = rec.qTo;
+  Ckpt.savedP = rec.pTo;
+  return;
+
+ fail:
+  svd_error("svdLAS2: failed to write checkpoint file %s, continuing "
+            "without it", Run.checkpointFile);
+  fclose(file);
+  Ckpt.file = NULL;
+}
+
+/***********************************************************************
+ *                                                                     *
+ *                     checkpoint_close()                              *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   Function closes the checkpoint file.  Once the run has finished and 
+   the singular vectors have been formed, the file is no longer needed and
+   is removed.  If ritvec() failed, it is kept, so that a rerun resumes 
+   from its last record rather than from the start.
+
+ ***********************************************************************/
+
+void checkpoint_close(char finished) {
+  if (Ckpt.file) {
+    fclose(Ckpt.file);
+    if (finished) remove(Run.checkpointFile);
+  }
+  memset(&Ckpt, 0, sizeof(Ckpt));
+}
+
+/***********************************************************************
+ *                                                                     *
+ *                        ritz_bounds()                                *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   Function computes the Ritz values of the tridiagonal matrix T of 
+   order j+1 built so far, and the error bound of each, splitting T 
+   wherever an element of bet is zero.  bet[j+1] must be rnm.
+
+   Arguments 
+   ---------
+
+   (input)
+   j        index of the last Lanczos step taken
+   alf      diagonal of T
+   bet      off-diagonal of T
+   rnm      norm of the next residual vector
+   wrk      work array of length j+1
+
+   (output)
+   ritz     Ritz values, in no particular order
+   bnd      error bounds of the Ritz values
+
+   Functions used
+   --------------
+
+   BLAS		svd_dcopy
+   LAS		imtqlb
+
+ ***********************************************************************/
+
+void ritz_bounds(long j, double *alf, double *bet, double *ritz, double *bnd,
+                 double *wrk, double rnm) {
+  long i, l = 0, id2, id3;
+
+  for (id2 = 0; id2 < j; id2++) {
+    if (l > j) break;
+    for (i = l; i <= j; i++) if (!bet[i+1]) break;
+    if (i > j) i = j;
+    
+    /* now i is at the end of an unreduced submatrix */
+    svd_dcopy(i-l+1, &alf[l],   1, &ritz[l],  -1);
+    svd_dcopy(i-l,   &bet[l+1], 1, &wrk[l+1], -1);
+    
+    imtqlb(i-l+1, &ritz[l], &wrk[l], &bnd[l]);
+    
+    if (ierr) {
+      svd_error("svdLAS2: imtqlb failed to converge (ierr = %ld)\n", ierr);
+      svd_error("  l = %ld  i = %ld\n", l, i);
+      for (id3 = l; id3 <= i; id3++) 
+        svd_error("  %ld  %lg  %lg  %lg\n", 
+                  id3, ritz[id3], wrk[id3], bnd[id3]);
+    }
+    for (id3 = l; id3 <= i; id3++) 
+      bnd[id3] = rnm * fabs(bnd[id3]);
+    l = i + 1;
+  }
+}
+
+/***********************************************************************
+ *                                                                     *
+ *                          progress()                                 *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   Function reports the state of the run to SVDProgress.  It is called 
+   from lanczos_step() before taking step, and analyzes the tridiagonal 
+   matrix of the steps taken so far the same way lanso() does, using 
+   the ritz and bnd arrays, which lanso() refills after every call to 
+   lanczos_step().  Returns TRUE if SVDProgress asked to cancel the run.
+
+   Functions used
+   --------------
+
+   LAS		ritz_bounds, error_bound
+   UTILITY	svd_dsort2
+
+ ***********************************************************************/
+
+char progress(long step, double *alf, double *bet, double rnm, double tol) {
+  double *ritz = Progress.ritz, *bnd = Progress.bnd;
+  long j = step - 1, neig, enough = FALSE, error = ierr;
+  struct timeval tv;
+
+  /* bet[step] is set to rnm when the step is taken. */
+  bet[step] = rnm;
+  if (j) ritz_bounds(j, alf, bet, ritz, bnd, OPBTemp, rnm);
+  else {
+    ritz[0] = alf[0];
+    bnd[0] = rnm;
+  }
+  svd_dsort2((j+1) / 2, j + 1, ritz, bnd);
+  neig = error_bound(&enough, Progress.endl, Progress.endr, ritz, bnd, j, tol);
+  ierr = error;
+
+  gettimeofday(&tv, NULL);
+  if (Run.progress(step, neig, j + 1, ritz, bnd, 
+                  tv.tv_sec + tv.tv_usec * 1e-6 - Progress.start, 
+                  SVDProgressData))
+    Progress.cancelled = TRUE;
+  return Progress.cancelled;
+}
+
+/***********************************************************************
+ *                                                                     *
+ *                              opb()                                  *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   Function computes y = p(A'A) x, the operator of the Lanczos run.  
+   Without a filter p is the identity and this is just op_b().  With
+   one, p is the Chebyshev polynomial of degree Filter.degree mapped to
+   the damped interval and scaled so that p(0) = 1, evaluated with the
+   three-term recurrence of Zhou and Saad (J. Comput. Phys. 2007), which 
+   keeps the iterates from overflowing.  Eigenvalues of A'A below the 
+   interval are then mapped to the largest eigenvalues of p(A'A), and
+   those in it to values near zero.
+
+   Functions used
+   --------------
+
+   BLAS		svd_dscal, svd_daxpy, svd_dcopy
+   USER		op_b
+
+ ***********************************************************************/
+
+void opb(SMat A, double *x, double *y, double *temp) {
+  double e, c, sigma, sigma1, sigmanew, *xk, *yk, *zk, *t;
+  long i, k, n = (Transposed) ? A->rows : A->cols;
+
+  if (!Filter.degree) {
+    op_b(A, x, y, temp);
+    return;
+  }
+  e = (Filter.upper - Filter.lower) / 2.0;
+  c = (Filter.upper + Filter.lower) / 2.0;
+  sigma = sigma1 = e / (0.0 - c);
+  xk = Filter.x;
+  yk = Filter.y;
+  zk = Filter.z;
+
+  /* yk = (A'A - cI) x * sigma1 / e */
+  svd_dcopy(n, x, 1, xk, 1);
+  op_b(A, x, yk, temp);
+  svd_daxpy(n, -c, x, 1, yk, 1);
+  svd_dscal(n, sigma1 / e, yk, 1);
+
+  for (k = 2; k <= Filter.degree; k++) {
+    sigmanew = 1.0 / (2.0 / sigma1 - sigma);
+    /* zk = (A'A - cI) yk * 2 sigmanew / e - sigma sigmanew xk */
+    op_b(A, yk, zk, temp);
+    for (i = 0; i < n; i++)
+      zk[i] = (zk[i] - c * yk[i]) * (2.0 * sigmanew / e) - 
+        sigma * sigmanew * xk[i];
+    t = xk;
+    xk = yk;
+    yk = zk;
+    zk = t;
+    sigma = sigmanew;
+  }
+  svd_dcopy(n, yk, 1, y, 1);
+}
+
+/***********************************************************************
+ *                                                                     *
+ *                         sort_ascending()                            *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   Function puts the singular triples of R in increasing order of 
+   singular value.  ritvec() returns them in decreasing order of the 
+   filtered eigenvalue, which is nearly, but not always exactly, the 
+   increasing order of the singular value.
+
+ ***********************************************************************/
+
+void sort_ascending(SVDRec R) {
+  long i, j;
+  double s, *u, *v;
+
+  if (R->d < 2) return;
+  u = svd_doubleArray(R->Ut->cols, FALSE, "sort_ascending: u");
+  v = svd_doubleArray(R->Vt->cols, FALSE, "sort_ascending: v");
+  if (!u || !v) {
+    SAFE_FREE(u);
+    SAFE_FREE(v);
+    return;
+  }
+  /* Insertion sort, moving the vectors along with the values. */
+  for (i = 1; i < R->d; i++) {
+    if (R->S[i-1] <= R->S[i]) continue;
+    s = R->S[i];
+    memcpy(u, R->Ut->value[i], R->Ut->cols * sizeof(double));
+    memcpy(v, R->Vt->value[i], R->Vt->cols * sizeof(double));
+    for (j = i; j > 0 && R->S[j-1] > s; j--) {
+      R->S[j] = R->S[j-1];
+      memcpy(R->Ut->value[j], R->Ut->value[j-1], 
+             R->Ut->cols * sizeof(double));
+      memcpy(R->Vt->value[j], R->Vt->value[j-1], 
+             R->Vt->cols * sizeof(double));
+    }
+    R->S[j] = s;
+    memcpy(R->Ut->value[j], u, R->Ut->cols * sizeof(double));
+    memcpy(R->Vt->value[j], v, R->Vt->cols * sizeof(double));
+  }
+  SAFE_FREE(u);
+  SAFE_FREE(v);
+}
+
+/***********************************************************************
+ *                                                                     *
+ *                          op_a(), op_b()                             *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   Functions multiply by A and by B = A'A, or by A' and B = AA' when the
+   run is made on the transpose.  op_b() needs a temporary array as long
+   as the other dimension of A.
+
+   Functions used
+   --------------
+
+   USER		svd_opa, svd_opat, svd_opb
+
+ ***********************************************************************/
+
+void op_a(SMat A, double *x, double *y) {
+  if (Transposed) svd_opat(A, x, y);
+  else svd_opa(A, x, y);
+}
+
+void op_b(SMat A, double *x, double *y, double *temp) {
+  if (Transposed) {
+    svd_opat(A, x, temp);
+    svd_opa(A, temp, y);
+  } else svd_opb(A, x, y, temp);
+}
+
+/***********************************************************************
+ *                                                                     *
+ *                          svdPlanLAS2()                              *
+ *                                                                     *
+ ***********************************************************************/
+/***********************************************************************
+
+   Description
+   -----------
+
+   Function works out the memory svdLAS2 (or svdLAS2Smallest, if degree 
+   is nonzero) needs for a matrix of the given size, from the 
+   allocations it makes.  The workspace is reserved for all iterations 
+   steps up front, though the pages of Lanczos vectors that are never 
+   stored are never touched, so the peak is reached only if the run takes
+   them all.  The most memory is in use in ritvec(), which holds the 
+   eigenvectors of T and the result alongside the whole workspace.
+
+   If budget is positive and the peak would exceed it, iterations is 
+   lowered, though not below dimensions, until it fits.  This bounds
+   both the Lanczos vectors and the eigenvectors of T.
+
+   Returns 0 if the plan fits in budget (or budget is not positive), and 
+   1 otherwise.
+
+ ***********************************************************************/
+
+static void plan(struct svdplan *P, long degree) {
+  long n, other, it = P->iterations, d = P->dimensions, vec;
+
+  n = (P->transposed) ? P->rows : P->cols;
+  other = (P->transposed) ? P->cols : P->rows;
+  vec = SVD_ALIGNED(n * sizeof(double));
+
+  P->matrix = sizeof(struct smat) + (P->cols + 1) * sizeof(long) + 
+    P->vals * (sizeof(long) + sizeof(double));
+  P->basis = (it + MAXLL) * (sizeof(double *) + vec);
+  /* wptr, ritz, bnd, OPBTemp and the filter vectors, which are all carved
+     from the workspace and kept until the end of the run */
+  P->lanczos = (6 + ((degree) ? 3 : 0)) * vec + 
+    3 * SVD_ALIGNED(it * sizeof(double)) + 
+    3 * SVD_ALIGNED((it + 1) * sizeof(double)) + 
+    SVD_ALIGNED(other * sizeof(double));
+  /* ritvec's s, xv2, w1 and keep */
+  P->vectors = (it * it + n + 2 * (it + 1)) * sizeof(double);
+  /* With SVDOutput, only one pair of vectors is held at a time. */
+  if (SVDOutput && !SVDBatchRun)
+    P->result = sizeof(struct svdrec) + (d + other + n) * sizeof(double);
+  else P->result = sizeof(struct svdrec) + 2 * sizeof(struct dmat) + 
+    2 * d * sizeof(double *) + d * (other + n + 1) * sizeof(double);
+  P->peak = P->matrix + P->basis + P->lanczos + P->vectors + P->result;
+}
+
+int svdPlanLAS2(struct svdplan *P, long rows, long cols, long vals, 
+                long dimensions, long iterations, long degree, long budget) {
+  long m = svd_imin(rows, cols), lo, hi;
+
+  memset(P, 0, sizeof(struct svdplan));
+  P->rows = rows;
+  P->cols = cols;
+  P->vals = vals;
+  if (dimensions <= 0 || dimensions > m) dimensions = m;
+  if (iterations <= 0 || iterations > m) iterations = m;
+  if (iterations < dimensions) iterations = dimensions;
+  P->dimensions = dimensions;
+  P->iterations = iterations;
+  P->transposed = (cols >= rows * 1.2 || (degree && cols > rows));
+  plan(P, degree);
+  if (budget <= 0 || P->peak <= budget) return 0;
+
+  /* The peak grows with iterations, so search for the most that fit. */
+  P->iterations = lo = dimensions;
+  plan(P, degree);
+  if (P->peak > budget) return 1;
+  hi = iterations;
+  while (hi - lo > 1) {
+    P->iterations = (lo + hi) / 2;
+    plan(P, degree);
+    if (P->peak <= budget) lo = P->iterations;
+    else hi = P->iterations;
+  }
+  P->iterations = lo;
+  plan(P, degree);
+  return 0;
+}
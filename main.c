@@ -38,7 +38,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <sys/resource.h>
 #include "svdlib.h"
 
-enum algorithms{LAS2};
+enum algorithms{LAS2, GKL};
 
 /***********************************************************************
  *                                                                     *
@@ -78,26 +78,61 @@ static void fatalError(char *fmt, ...) {
   exit(1);
 }
 
+/* Reads a number of bytes with an optional K, M or G suffix. */
+static long parseBytes(char *arg, char *what) {
+  char *unit;
+  double bytes = strtod(arg, &unit);
+  switch (*unit) {
+  case 'g': case 'G': bytes *= 1024;  /* fall through */
+  case 'm': case 'M': bytes *= 1024;  /* fall through */
+  case 'k': case 'K': bytes *= 1024;
+  case '\0': break;
+  default: fatalError("bad %s: %s", what, arg);
+  }
+  if (bytes <= 0) fatalError("%s must be positive", what);
+  return (long) bytes;
+}
+
 void printUsage(char *progname) {
   debug("SVD Version %s\n" 
         "written by Douglas Rohde based on code adapted from SVDPACKC\n\n", SVDVersion);
-  debug("usage: %s [options] matrix_file\n", progname);
+  debug("usage: %s [options] matrix_file...\n", progname);
   debug("  -a algorithm   Sets the algorithm to use.  They include:\n"
         "       las2 (default)\n"
+        "       gkl       Golub-Kahan-Lanczos bidiagonalization of A\n"
+        "  -C file        Checkpoint las2 to file, resuming if it exists\n"
         "  -c infile outfile\n"
         "                 Convert a matrix file to a new format (using -r and -w)\n"
         "                 Then exit immediately\n"
         "  -d dimensions  Desired SVD triples (default is all)\n"
         "  -e bound       Minimum magnitude of wanted eigenvalues (1e-30)\n"
+        "  -f             Write sb2, db2 and npy values as 4-byte floats\n"
+        "  -H pages       Back las2 work space with huge pages: thp or explicit\n"
         "  -k kappa       Accuracy parameter for las2 (1e-6)\n"
         "  -i iterations  Algorithm iterations\n"
+        "  -K directory   Cache text matrices there as mapped binary files\n"
+        "  -L bytes       Size limit for the -K cache, with a K, M or G suffix\n"
+        "  -N steps       Lanczos steps between checkpoints (100)\n"
+        "  -n policy      NUMA placement: interleave or partition\n"
+        "  -M bytes       Memory limit for las2, with an optional K, M or G suffix\n"
         "  -o file_root   Root of files in which to store resulting U,S,V\n"
+        "  -P             Print the memory plan for las2 and exit\n"
+        "  -p digits      Significant digits of values in text output (6),\n"
+        "                 or 0 for just enough to read back exactly\n"
         "  -r format      Input matrix file format\n"
         "       sth       SVDPACK Harwell-Boeing text format\n"
         "       st        Sparse text (default)\n"
         "       dt        Dense text\n"
         "       sb        Sparse binary\n"
+        "       sbm       Sparse binary, native and memory-mapped\n"
+        "       mm        Matrix Market coordinate text\n"
         "       db        Dense binary\n"
+        "       sb2       Sparse binary, 8-byte counts and double values\n"
+        "       db2       Dense binary, 8-byte counts and double values\n"
+        "       npy       NumPy array of little-endian doubles\n"
+        "  -s degree      Find the smallest singular triples with las2, using a\n"
+        "                 Chebyshev filter of this degree (0 for the default)\n"
+        "  -T threads     Threads to use (default is one per processor)\n"
         "  -v verbosity   Default 1.  0 for no feedback, 2 for more\n"
         "  -w format      Output matrix file format (see -r for formats)\n"
         "                   (default is dense text)\n");
@@ -118,39 +153,36 @@ int main(int argc, char *argv[]) {
   int writeFormat = SVD_F_DT;
   int algorithm = LAS2;
   int iterations = 0;
+  int smallest = FALSE, degree = 0;
+  char planOnly = FALSE;
   int dimensions = 0;
   char *vectorFile = NULL;
+  char utFile[128], sFile[128], vtFile[128];
+  SVDSink sink = NULL;
   double las2end[2] = {-1.0e-30, 1.0e-30};
   double kappa = 1e-6;
   double exetime;
 
-  while ((opt = getopt(argc, argv, "a:c:d:e:hk:i:o:r:tv:w:")) != -1) {
+  while ((opt = getopt(argc, argv, "a:C:c:d:e:fH:hk:i:K:L:M:N:n:o:Pp:r:s:T:tv:w:")) != -1) {
     switch (opt) {
     case 'a':
       if (!strcasecmp(optarg, "las2"))
         algorithm = LAS2;
+      else if (!strcasecmp(optarg, "gkl"))
+        algorithm = GKL;
       else fatalError("unknown algorithm: %s", optarg);
       break;
+    case 'C':
+      SVDCheckpointFile = optarg;
+      break;
     case 'c':
       if (optind != argc - 1) printUsage(argv[0]);
       if (SVDVerbosity > 0) printf("Converting %s to %s\n", optarg, argv[optind]);
-      if (SVD_IS_SPARSE(readFormat) && SVD_IS_SPARSE(writeFormat)) {
-        SMat S = svdLoadSparseMatrix(optarg, readFormat);
-        if (!S) fatalError("failed to read sparse matrix");
-        if (transpose) {
-          if (SVDVerbosity > 0) printf("  Transposing the matrix...\n");
-          S = svdTransposeS(S); /* This leaks memory. */
-        }
-        svdWriteSparseMatrix(S, argv[optind], writeFormat);
-      } else {
-        DMat D = svdLoadDenseMatrix(optarg, readFormat);
-        if (!D) fatalError("failed to read dense matrix");
-        if (transpose) {
-          if (SVDVerbosity > 0) printf("  Transposing the matrix...\n");
-          D = svdTransposeD(D); /* This leaks memory. */
-        }
-        svdWriteDenseMatrix(D, argv[optind], writeFormat);
-      }
+      if (transpose && SVDVerbosity > 0) 
+        printf("  Transposing the matrix...\n");
+      if (svdConvertMatrixFile(optarg, readFormat, argv[optind], writeFormat,
+                               transpose))
+        fatalError("failed to convert the matrix");
       exit(0);
       break;
     case 'd':
@@ -161,6 +193,14 @@ int main(int argc, char *argv[]) {
       las2end[1] = atof(optarg);
       las2end[0] = -las2end[1];
       break;
+    case 'f':
+      SVDBinaryFloat = TRUE;
+      break;
+    case 'H':
+      if (!strcasecmp(optarg, "thp")) SVDHugePages = 1;
+      else if (!strcasecmp(optarg, "explicit")) SVDHugePages = 2;
+      else fatalError("huge pages must be thp or explicit");
+      break;
     case 'h':
       printUsage(argv[0]);
       break;
@@ -170,9 +210,38 @@ int main(int argc, char *argv[]) {
     case 'i':
       iterations = atoi(optarg);
       break;
+    case 'K':
+      SVDCacheDir = optarg;
+      break;
+    case 'L':
+      SVDCacheLimit = parseBytes(optarg, "cache limit");
+      break;
+    case 'M':
+      SVDMemoryLimit = parseBytes(optarg, "memory limit");
+      break;
+    case 'N':
+      SVDCheckpointInterval = atoi(optarg);
+      if (SVDCheckpointInterval <= 0) 
+        fatalError("checkpoint interval must be positive");
+      break;
+    case 'n':
+      if (!strcasecmp(optarg, "interleave")) 
+        SVDNumaPolicy = SVD_NUMA_INTERLEAVE;
+      else if (!strcasecmp(optarg, "partition")) 
+        SVDNumaPolicy = SVD_NUMA_PARTITION;
+      else fatalError("NUMA policy must be interleave or partition");
+      break;
     case 'o':
       vectorFile = optarg;
       break;
+    case 'P':
+      planOnly = TRUE;
+      break;
+    case 'p':
+      SVDPrecision = atoi(optarg);
+      if (SVDPrecision < 0 || SVDPrecision > 17) 
+        fatalError("precision must be between 0 and 17");
+      break;
     case 'r':
       if (!strcasecmp(optarg, "sth")) {
         readFormat = SVD_F_STH;
@@ -182,10 +251,28 @@ int main(int argc, char *argv[]) {
         readFormat = SVD_F_DT;
       } else if (!strcasecmp(optarg, "sb")) {
         readFormat = SVD_F_SB;
+      } else if (!strcasecmp(optarg, "sbm")) {
+        readFormat = SVD_F_SBM;
+      } else if (!strcasecmp(optarg, "mm")) {
+        readFormat = SVD_F_MM;
+      } else if (!strcasecmp(optarg, "sb2")) {
+        readFormat = SVD_F_SB2;
+      } else if (!strcasecmp(optarg, "db2")) {
+        readFormat = SVD_F_DB2;
+      } else if (!strcasecmp(optarg, "npy")) {
+        readFormat = SVD_F_NPY;
       } else if (!strcasecmp(optarg, "db")) {
         readFormat = SVD_F_DB;
       } else fatalError("bad file format: %s", optarg);
       break;
+    case 's':
+      smallest = TRUE;
+      degree = atoi(optarg);
+      break;
+    case 'T':
+      SVDThreads = atoi(optarg);
+      if (SVDThreads <= 0) fatalError("threads must be positive");
+      break;
     case 't':
       transpose = TRUE;
       break;
@@ -202,6 +289,16 @@ int main(int argc, char *argv[]) {
         writeFormat = SVD_F_DT;
       } else if (!strcasecmp(optarg, "sb")) {
         writeFormat = SVD_F_SB;
+      } else if (!strcasecmp(optarg, "sbm")) {
+        writeFormat = SVD_F_SBM;
+      } else if (!strcasecmp(optarg, "mm")) {
+        writeFormat = SVD_F_MM;
+      } else if (!strcasecmp(optarg, "sb2")) {
+        writeFormat = SVD_F_SB2;
+      } else if (!strcasecmp(optarg, "db2")) {
+        writeFormat = SVD_F_DB2;
+      } else if (!strcasecmp(optarg, "npy")) {
+        writeFormat = SVD_F_NPY;
       } else if (!strcasecmp(optarg, "db")) {
         writeFormat = SVD_F_DB;
       } else fatalError("bad file format: %s", optarg);
@@ -209,47 +306,121 @@ int main(int argc, char *argv[]) {
     default: printUsage(argv[0]);
     }
   }
-  if (optind != argc - 1) printUsage(argv[0]);
+  if (optind >= argc) printUsage(argv[0]);
 
-  if (SVDVerbosity > 0) printf("Loading the matrix...\n");
-  A = svdLoadSparseMatrix(argv[optind], readFormat);
-  if (!A) fatalError("failed to read sparse matrix.  Did you specify the correct file type with the -r argument?");
-  if (transpose) {
-    if (SVDVerbosity > 0) printf("  Transposing the matrix...\n");
-    SMat T = A;
-    A = svdTransposeS(A);
-    svdFreeSMat(T);
+  if (planOnly) {
+    struct svdplan P;
+    long rows, cols, vals, r, c, v;
+    int fits, i;
+    if (algorithm != LAS2) fatalError("-P is only available with las2");
+    /* Several files are laid side by side. */
+    for (i = optind, rows = cols = vals = 0; i < argc; i++) {
+      if (svdLoadMatrixSize(argv[i], readFormat, &r, &c, &v))
+        fatalError("failed to read the matrix size");
+      if (i > optind && r != rows) fatalError("%s has %ld rows, not %ld",
+                                              argv[i], r, rows);
+      rows = r;
+      cols += c;
+      vals += v;
+    }
+    /* -t only swaps U and V afterwards, so A is planned for as it is. */
+    fits = !svdPlanLAS2(&P, rows, cols, vals, dimensions, iterations, 
+                        (smallest) ? ((degree > 0) ? degree : 20) : 0, 
+                        SVDMemoryLimit);
+    printf("NO. OF ROWS               = %12ld\n"
+           "NO. OF COLUMNS            = %12ld\n"
+           "NO. OF NON-ZERO VALUES    = %12ld%s\n"
+           "DIMENSIONS                = %12ld\n"
+           "LANCZOS STEPS             = %12ld\n"
+           "SOLVED ON                 = %12s\n\n", 
+           rows, cols, vals, SVD_IS_SPARSE(readFormat) ? "" : " (at most)",
+           P.dimensions, P.iterations, (P.transposed) ? "AA^T" : "A^TA");
+    printf("MATRIX                    = %12ld bytes\n"
+           "LANCZOS VECTORS           = %12ld bytes\n"
+           "LANCZOS WORK SPACE        = %12ld bytes\n"
+           "SINGULAR VECTOR WORK      = %12ld bytes\n"
+           "RESULT (Ut, S, Vt)        = %12ld bytes\n"
+           "PEAK                      = %12ld bytes\n",
+           P.matrix, P.basis, P.lanczos, P.vectors, P.result, P.peak);
+    if (SVDMemoryLimit > 0)
+      printf("MEMORY LIMIT              = %12ld bytes (%s)\n", 
+             SVDMemoryLimit, (fits) ? "fits" : "does not fit");
+    return (fits) ? 0 : 1;
   }
 
+  if (SVDVerbosity > 0) printf("Loading the matrix...\n");
+  A = svdLoadSparseMatrices(argv + optind, argc - optind, readFormat);
+  if (!A) fatalError("failed to read sparse matrix.  Did you specify the correct file type with the -r argument?");
   if (dimensions <= 0) dimensions = imin(A->rows, A->cols);
 
+  /* las2 can write the vectors to a dense format as it finds them, so Ut 
+     and Vt are never held in full.  With -s they are then not sorted. */
+  if (vectorFile && algorithm == LAS2 && !SVD_IS_SPARSE(writeFormat)) {
+    sprintf(utFile, "%s-Ut", vectorFile);
+    sprintf(sFile, "%s-S", vectorFile);
+    sprintf(vtFile, "%s-Vt", vectorFile);
+    if (!(sink = svdNewFileSink((transpose) ? vtFile : utFile, sFile, 
+                                (transpose) ? utFile : vtFile, writeFormat)))
+      fatalError("failed to set up the output files");
+    SVDOutput = sink;
+  }
+
   exetime = timer();
 
   if (SVDVerbosity > 0) printf("Computing the SVD...\n");
-  if (algorithm == LAS2) {
+  if (smallest) {
+    if (algorithm != LAS2) fatalError("-s is only available with las2");
+    if (!(R = svdLAS2Smallest(A, dimensions, iterations, degree, kappa)))
+      fatalError("error in svdLAS2Smallest");
+  } else if (algorithm == LAS2) {
     if (!(R = svdLAS2(A, dimensions, iterations, las2end, kappa)))
       fatalError("error in svdLAS2");
+  } else if (algorithm == GKL) {
+    if (!(R = svdGKL(A, dimensions, iterations, kappa)))
+      fatalError("error in svdGKL");
   } else {
     fatalError("unknown algorithm");
   }
 
   exetime = timer() - exetime;
+
+  /* The SVD of the transpose just swaps the roles of U and V, so A itself
+     is never transposed. */
+  if (transpose) {
+    DMat T = R->Ut;
+    R->Ut = R->Vt;
+    R->Vt = T;
+  }
   if (SVDVerbosity > 0) {
     printf("\nELAPSED CPU TIME          = %6g sec.\n", exetime);
-    printf("MULTIPLICATIONS BY A      = %6ld\n", 
-           (SVDCount[SVD_MXV] - R->d) / 2 + R->d);
-    printf("MULTIPLICATIONS BY A^T    = %6ld\n", 
-           (SVDCount[SVD_MXV] - R->d) / 2);
+    if (algorithm == GKL) {
+      /* Multiplications by A and A^T alternate, starting with A. */
+      printf("MULTIPLICATIONS BY A      = %6ld\n", 
+             (SVDCount[SVD_MXV] + 1) / 2);
+      printf("MULTIPLICATIONS BY A^T    = %6ld\n", SVDCount[SVD_MXV] / 2);
+    } else {
+      printf("MULTIPLICATIONS BY A      = %6ld\n", 
+             (SVDCount[SVD_MXV] - R->d) / 2 + R->d);
+      printf("MULTIPLICATIONS BY A^T    = %6ld\n", 
+             (SVDCount[SVD_MXV] - R->d) / 2);
+    }
   }
 
-  if (vectorFile) {
+  if (sink) {
+    svdFreeFileSink(sink);
+  } else if (vectorFile) {
     char filename[128];
     sprintf(filename, "%s-Ut", vectorFile);
-    svdWriteDenseMatrix(R->Ut, filename, writeFormat);
+    if (svdWriteDenseMatrix(R->Ut, filename, writeFormat))
+      fatalError("failed to save the results");
     sprintf(filename, "%s-S", vectorFile);
-    svdWriteDenseArray(R->S, R->d, filename, FALSE);
+    if (svdWriteDenseArrayFormat(R->S, R->d, filename, 
+                                 (writeFormat == SVD_F_NPY) ? SVD_F_NPY : 
+                                 SVD_F_DT))
+      fatalError("failed to save the results");
     sprintf(filename, "%s-Vt", vectorFile);
-    svdWriteDenseMatrix(R->Vt, filename, writeFormat);
+    if (svdWriteDenseMatrix(R->Vt, filename, writeFormat))
+      fatalError("failed to save the results");
   }
   return 0;
 }
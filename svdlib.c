@@ -31,12 +31,36 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glob.h>
 #include "svdlib.h"
 #include "svdutil.h"
 
 char *SVDVersion = "1.4";
 long SVDVerbosity = 1;
-long SVDCount[SVD_COUNTERS];
+long SVDThreads = 0;
+char *SVDCheckpointFile = NULL;
+long SVDCheckpointInterval = 100;
+SVDProgressFunc SVDProgress = NULL;
+SVDSink SVDOutput = NULL;
+void *SVDProgressData = NULL;
+long SVDProgressInterval = 100;
+long SVDMemoryLimit = 0;
+long SVDPrecision = 6;
+long SVDBinaryFloat = FALSE;
+char *SVDCacheDir = NULL;
+long SVDCacheLimit = 0;
+long SVDHugePages = 0;
+long SVDNumaPolicy = SVD_NUMA_NONE;
+__thread long SVDCount[SVD_COUNTERS];
 
 void svdResetCounters(void) {
   int i;
@@ -58,7 +82,7 @@ DMat svdNewDMat(int rows, int cols) {
   D->value = (double **) malloc(rows * sizeof(double *));
   if (!D->value) {SAFE_FREE(D); return NULL;}
 
-  D->value[0] = (double *) calloc(rows * cols, sizeof(double));
+  D->value[0] = (double *) calloc((long) rows * cols, sizeof(double));
   if (!D->value[0]) {SAFE_FREE(D->value); SAFE_FREE(D); return NULL;}
 
   for (i = 1; i < rows; i++) D->value[i] = D->value[i-1] + cols;
@@ -73,7 +97,20 @@ void svdFreeDMat(DMat D) {
 }
 
 
-SMat svdNewSMat(int rows, int cols, int vals) {
+SVDWorkspace svdNewWorkspace(void) {
+  SVDWorkspace W = (SVDWorkspace) calloc(1, sizeof(struct svdworkspace));
+  if (!W) perror("svdNewWorkspace");
+  return W;
+}
+
+void svdFreeWorkspace(SVDWorkspace W) {
+  if (!W) return;
+  svd_release(W);
+  free(W);
+}
+
+
+SMat svdNewSMat(long rows, long cols, long vals) {
   SMat S = (SMat) calloc(1, sizeof(struct smat));
   if (!S) {perror("svdNewSMat"); return NULL;}
   S->rows = rows;
@@ -85,14 +122,32 @@ SMat svdNewSMat(int rows, int cols, int vals) {
   if (!S->rowind) {svdFreeSMat(S); return NULL;}
   S->value  = svd_doubleArray(vals, FALSE, "svdNewSMat: value");
   if (!S->value)  {svdFreeSMat(S); return NULL;}
+  /* The strips the matrix will be multiplied in aren't known until it is 
+     filled, but they have about equal numbers of entries, so even shares 
+     of the arrays are placed before anything touches them.  svdLAS2 moves 
+     what it must once the strips are known. */
+  if (SVDNumaPolicy && svd_numaNodes() > 1) {
+    long col[MAX_STRIPS + 1], entry[MAX_STRIPS + 1];
+    int k, parts = svd_imin(svd_threads(), MAX_STRIPS);
+    for (k = 0; k <= parts; k++) {
+      col[k] = (cols + 1) * k / parts;
+      entry[k] = vals * k / parts;
+    }
+    svd_numaSpread(S->pointr, sizeof(long), col, parts);
+    svd_numaSpread(S->rowind, sizeof(long), entry, parts);
+    svd_numaSpread(S->value, sizeof(double), entry, parts);
+  }
   return S;
 }
 
 void svdFreeSMat(SMat S) {
   if (!S) return;
-  SAFE_FREE(S->pointr);
-  SAFE_FREE(S->rowind);
-  SAFE_FREE(S->value);
+  if (S->map) munmap(S->map, S->mapSize);
+  else {
+    SAFE_FREE(S->pointr);
+    SAFE_FREE(S->rowind);
+    SAFE_FREE(S->value);
+  }
   free(S);
 }
 
@@ -116,99 +171,365 @@ void svdFreeSVDRec(SVDRec R) {
 
 /**************************** Conversion *************************************/
 
+/* Dense matrices are converted and transposed in TILE by TILE blocks, or
+   strips TILE columns wide, so that each cache line is used in full, with 
+   each task given its own strip of the output. */
+#define TILE 64
+
+struct tiles {
+  DMat D, N;
+  SMat S;
+  long *next;
+};
+
+static void stoDStrip(long t, int thread, void *arg) {
+  struct tiles *T = (struct tiles *) arg;
+  SMat S = T->S;
+  long c, v, end = (t + 1) * TILE;
+  if (end > S->cols) end = S->cols;
+  for (c = t * TILE; c < end; c++)
+    for (v = S->pointr[c]; v < S->pointr[c + 1]; v++)
+      T->D->value[S->rowind[v]][c] = S->value[v];
+}
+
 /* Converts a sparse matrix to a dense one (without affecting the former) */
 DMat svdConvertStoD(SMat S) {
-  int i, c;
+  struct tiles T;
   DMat D = svdNewDMat(S->rows, S->cols);
   if (!D) {
     svd_error("svdConvertStoD: failed to allocate D");
     return NULL;
   }
-  for (i = 0, c = 0; i < S->vals; i++) {
-    while (S->pointr[c + 1] <= i) c++;
-    D->value[S->rowind[i]][c] = S->value[i];
-  }
+  T.D = D;
+  T.S = S;
+  svd_parallel((S->cols + TILE - 1) / TILE, stoDStrip, &T);
   return D;
 }
 
+/* Counts the nonzeros of each column in a strip, reading it row by row. */
+static void dtoSCount(long t, int thread, void *arg) {
+  struct tiles *T = (struct tiles *) arg;
+  DMat D = T->D;
+  long i, j, first = t * TILE, end = first + TILE;
+  if (end > D->cols) end = D->cols;
+  for (i = 0; i < D->rows; i++)
+    for (j = first; j < end; j++)
+      if (D->value[i][j] != 0) T->next[j]++;
+}
+
+static void dtoSFill(long t, int thread, void *arg) {
+  struct tiles *T = (struct tiles *) arg;
+  DMat D = T->D;
+  SMat S = T->S;
+  long i, j, v, first = t * TILE, end = first + TILE;
+  if (end > D->cols) end = D->cols;
+  for (i = 0; i < D->rows; i++)
+    for (j = first; j < end; j++)
+      if (D->value[i][j] != 0) {
+        v = T->next[j]++;
+        S->rowind[v] = i;
+        S->value[v] = D->value[i][j];
+      }
+}
+
 /* Converts a dense matrix to a sparse one (without affecting the dense one) */
 SMat svdConvertDtoS(DMat D) {
+  struct tiles T;
   SMat S;
-  int i, j, n;
-  for (i = 0, n = 0; i < D->rows; i++)
-    for (j = 0; j < D->cols; j++)
-      if (D->value[i][j] != 0) n++;
+  long strips = (D->cols + TILE - 1) / TILE, j, n;
+  T.D = D;
+  if (!(T.next = svd_longArray(D->cols + 1, TRUE, "svdConvertDtoS: next")))
+    return NULL;
+  svd_parallel(strips, dtoSCount, &T);
+  for (j = 0, n = 0; j < D->cols; j++) {
+    long count = T.next[j];
+    T.next[j] = n;
+    n += count;
+  }
   
   S = svdNewSMat(D->rows, D->cols, n);
   if (!S) {
     svd_error("svdConvertDtoS: failed to allocate S");
+    SAFE_FREE(T.next);
     return NULL;
   }
-  for (j = 0, n = 0; j < D->cols; j++) {
-    S->pointr[j] = n;
-    for (i = 0; i < D->rows; i++)
-      if (D->value[i][j] != 0) {
-        S->rowind[n] = i;
-        S->value[n] = D->value[i][j];
-        n++;
-      }
-  }
+  memcpy(S->pointr, T.next, D->cols * sizeof(long));
   S->pointr[S->cols] = S->vals;
+  T.S = S;
+  svd_parallel(strips, dtoSFill, &T);
+  SAFE_FREE(T.next);
   return S;
 }
 
+/* Transposes the TILE rows of the output in strip t, a tile at a time. */
+static void transposeStrip(long t, int thread, void *arg) {
+  struct tiles *T = (struct tiles *) arg;
+  DMat D = T->D, N = T->N;
+  long r, c, r0, c0 = t * TILE, cEnd = c0 + TILE, rEnd;
+  if (cEnd > D->cols) cEnd = D->cols;
+  for (r0 = 0; r0 < D->rows; r0 += TILE) {
+    rEnd = (r0 + TILE < D->rows) ? r0 + TILE : D->rows;
+    for (c = c0; c < cEnd; c++)
+      for (r = r0; r < rEnd; r++)
+        N->value[c][r] = D->value[r][c];
+  }
+}
+
 /* Transposes a dense matrix. */
 DMat svdTransposeD(DMat D) {
-  int r, c;
+  struct tiles T;
   DMat N = svdNewDMat(D->cols, D->rows);
-  for (r = 0; r < D->rows; r++)
-    for (c = 0; c < D->cols; c++)
-      N->value[c][r] = D->value[r][c];
+  if (!N) return NULL;
+  T.D = D;
+  T.N = N;
+  svd_parallel((D->cols + TILE - 1) / TILE, transposeStrip, &T);
   return N;
 }
 
+/* A sparse matrix is transposed by a counting sort of its entries by row.
+   The columns are cut into one chunk per thread, each with its own count 
+   of the entries in each row, and the counts are then summed so that each
+   chunk places its entries of a row after those of the chunks before it, 
+   keeping every row in column order. */
+struct transposeS {
+  SMat S, N;
+  long chunks, *first, **count;
+  char inPlace;
+};
+
+static void transposeSCount(long p, int thread, void *arg) {
+  struct transposeS *T = (struct transposeS *) arg;
+  SMat S = T->S;
+  long v, end = S->pointr[T->first[p + 1]], *count = T->count[p];
+  for (v = S->pointr[T->first[p]]; v < end; v++) count[S->rowind[v]]++;
+}
+
+/* Places each entry of chunk p, or in place, just notes where it goes. */
+static void transposeSScatter(long p, int thread, void *arg) {
+  struct transposeS *T = (struct transposeS *) arg;
+  SMat S = T->S, N = T->N;
+  long c, v, j, *next = T->count[p];
+  for (c = T->first[p]; c < T->first[p + 1]; c++)
+    for (v = S->pointr[c]; v < S->pointr[c + 1]; v++) {
+      j = next[S->rowind[v]]++;
+      if (T->inPlace) S->rowind[v] = j;
+      else {
+        N->rowind[j] = c;
+        N->value[j] = S->value[v];
+      }
+    }
+}
+
+/* Fills pointr, of length S->rows + 1, with the start of each row, and
+   leaves T->count set for transposeSScatter. */
+static char transposeSPlan(struct transposeS *T, long *pointr) {
+  SMat S = T->S;
+  long p, c, r, n, run;
+  T->chunks = svd_threads();
+  /* Each chunk costs a count per row, so small matrices take fewer. */
+  if (S->rows > 0 && T->chunks * S->rows > S->vals) 
+    T->chunks = svd_imax(1, S->vals / S->rows);
+  T->first = svd_longArray(T->chunks + 1, FALSE, "svdTransposeS: first");
+  T->count = (long **) calloc(T->chunks, sizeof(long *));
+  if (!T->first || !T->count) return TRUE;
+  for (p = 0; p < T->chunks; p++)
+    if (!(T->count[p] = svd_longArray(S->rows + 1, TRUE, 
+                                      "svdTransposeS: count"))) return TRUE;
+  for (p = 0, c = 0; p < T->chunks; p++) {
+    while (c < S->cols && S->pointr[c] < p * (S->vals / T->chunks)) c++;
+    T->first[p] = c;
+  }
+  T->first[T->chunks] = S->cols;
+  svd_parallel(T->chunks, transposeSCount, T);
+  for (r = 0, run = 0; r < S->rows; r++) {
+    pointr[r] = run;
+    for (p = 0; p < T->chunks; p++) {
+      n = T->count[p][r];
+      T->count[p][r] = run;
+      run += n;
+    }
+  }
+  pointr[S->rows] = run;
+  return FALSE;
+}
+
+static void transposeSFree(struct transposeS *T) {
+  long p;
+  for (p = 0; T->count && p < T->chunks; p++) SAFE_FREE(T->count[p]);
+  SAFE_FREE(T->count);
+  SAFE_FREE(T->first);
+}
+
 /* Efficiently transposes a sparse matrix. */
 SMat svdTransposeS(SMat S) {
-  int r, c, i, j;
+  struct transposeS T;
   SMat N = svdNewSMat(S->cols, S->rows, S->vals);
-  /* Count number nz in each row. */
-  for (i = 0; i < S->vals; i++)
-    N->pointr[S->rowind[i]]++;
-  /* Fill each cell with the starting point of the previous row. */
-  N->pointr[S->rows] = S->vals - N->pointr[S->rows - 1];
-  for (r = S->rows - 1; r > 0; r--)
-    N->pointr[r] = N->pointr[r+1] - N->pointr[r-1];
-  N->pointr[0] = 0;
-  /* Assign the new columns and values. */
-  for (c = 0, i = 0; c < S->cols; c++) {
-    for (; i < S->pointr[c+1]; i++) {
-      r = S->rowind[i];
-      j = N->pointr[r+1]++;
-      N->rowind[j] = c;
-      N->value[j] = S->value[i];
-    }
+  if (!N) return NULL;
+  memset(&T, 0, sizeof(struct transposeS));
+  T.S = S;
+  T.N = N;
+  if (transposeSPlan(&T, N->pointr)) {
+    svd_error("svdTransposeS: out of memory");
+    transposeSFree(&T);
+    svdFreeSMat(N);
+    return NULL;
   }
+  svd_parallel(T.chunks, transposeSScatter, &T);
+  transposeSFree(&T);
   return N;
 }
 
+/* The column holding entry v, from the column starts. */
+static long oldColumn(const long *pointr, long cols, long v) {
+  long lo = 0, hi = cols, mid;
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (pointr[mid] <= v) lo = mid; 
+    else hi = mid;
+  }
+  return lo;
+}
+
+/* Transposes S within its own arrays.  Once each rowind holds where its 
+   entry goes, the entries are moved along each cycle of that permutation,
+   carrying the value and the column, which is found from the old pointr.
+   A bit per entry marks those already moved. */
+SMat svdTransposeSInPlace(SMat S) {
+  struct transposeS T;
+  long *pointr, *old, v, d, c, col, nextD, nextCol, rows;
+  unsigned char *done;
+  double value, nextValue;
+  if (S->map) {
+    SMat N = svdTransposeS(S);
+    if (N) svdFreeSMat(S);
+    return N;
+  }
+  memset(&T, 0, sizeof(struct transposeS));
+  T.S = S;
+  T.inPlace = TRUE;
+  pointr = svd_longArray(S->rows + 1, FALSE, "svdTransposeSInPlace: pointr");
+  done = (unsigned char *) calloc(S->vals / 8 + 1, 1);
+  if (!pointr || !done || transposeSPlan(&T, pointr)) {
+    svd_error("svdTransposeSInPlace: out of memory");
+    transposeSFree(&T);
+    SAFE_FREE(pointr);
+    SAFE_FREE(done);
+    return NULL;
+  }
+  svd_parallel(T.chunks, transposeSScatter, &T);
+  transposeSFree(&T);
+
+  old = S->pointr;
+  for (v = 0, c = 0; v < S->vals; v++) {
+    while (old[c + 1] <= v) c++;
+    if (done[v >> 3] & (1 << (v & 7))) continue;
+    value = S->value[v];
+    col = c;
+    for (d = S->rowind[v]; d != v; d = nextD) {
+      nextD = S->rowind[d];
+      nextValue = S->value[d];
+      nextCol = oldColumn(old, S->cols, d);
+      S->rowind[d] = col;
+      S->value[d] = value;
+      done[d >> 3] |= 1 << (d & 7);
+      value = nextValue;
+      col = nextCol;
+    }
+    S->rowind[v] = col;
+    S->value[v] = value;
+    done[v >> 3] |= 1 << (v & 7);
+  }
+  free(done);
+  free(old);
+  S->pointr = pointr;
+  rows = S->rows;
+  S->rows = S->cols;
+  S->cols = rows;
+  return S;
+}
 
 /**************************** Input/Output ***********************************/
 
-void svdWriteDenseArray(double *a, int n, char *filename, char binary) {
-  int i;
+/* Text values are formatted in segments, each into its own buffer, on all
+   the threads, and the buffers are then written out in order. */
+#define SEGMENT_VALUES (1 << 16)
+
+struct textOut {
+  const double *value;
+  long n, cols, first;
+  char **buf;
+  long *len;
+};
+
+static void formatSegment(long i, int thread, void *arg) {
+  struct textOut *T = (struct textOut *) arg;
+  long v = (T->first + i) * SEGMENT_VALUES, end = v + SEGMENT_VALUES;
+  char *b = T->buf[i];
+  if (end > T->n) end = T->n;
+  for (; v < end; v++) {
+    b += svd_formatDouble(b, T->value[v], (int) SVDPrecision);
+    *b++ = ((v + 1) % T->cols) ? ' ' : '\n';
+  }
+  T->len[i] = b - T->buf[i];
+}
+
+/* Writes n values, cols to a line, as "%g" with spaces between them.
+   Returns TRUE if it runs out of memory. */
+static char writeValues(FILE *file, const double *value, long n, long cols) {
+  long segments = (n + SEGMENT_VALUES - 1) / SEGMENT_VALUES;
+  long batch = 2 * svd_threads(), i, m;
+  struct textOut T;
+  T.value = value;
+  T.n = n;
+  T.cols = cols;
+  if (batch > segments) batch = segments;
+  T.buf = (char **) calloc(batch, sizeof(char *));
+  T.len = svd_longArray(batch, FALSE, "writeValues: len");
+  for (i = 0; T.buf && i < batch; i++)
+    if (!(T.buf[i] = (char *) malloc(SEGMENT_VALUES * SVD_NUMBER_LEN))) break;
+  if (!T.buf || !T.len || i < batch) {
+    svd_error("writeValues: out of memory");
+    segments = -1;
+  }
+  for (T.first = 0; T.first < segments; T.first += m) {
+    m = segments - T.first;
+    if (m > batch) m = batch;
+    svd_parallel(m, formatSegment, &T);
+    for (i = 0; i < m; i++) fwrite(T.buf[i], 1, T.len[i], file);
+  }
+  for (i = 0; T.buf && i < batch; i++) SAFE_FREE(T.buf[i]);
+  SAFE_FREE(T.buf);
+  SAFE_FREE(T.len);
+  return (segments < 0);
+}
+
+/* Closes a file that has been written, reporting any error in writing it.
+   Returns TRUE on failure. */
+static char closeWritten(FILE *file, char *filename) {
+  char e = ferror(file) != 0;
+  if (svd_closeFile(file) || e) {
+    svd_error("failed to write %s", filename);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+char svdWriteDenseArray(double *a, int n, char *filename, char binary) {
+  char e = FALSE;
   FILE *file = svd_writeFile(filename, FALSE);
-  if (!file) 
-    return svd_error("svdWriteDenseArray: failed to write %s", filename);
+  if (!file) {
+    svd_error("svdWriteDenseArray: failed to write %s", filename);
+    return TRUE;
+  }
   if (binary) {
-    svd_writeBinInt(file, n);
-    for (i = 0; i < n; i++)
-      svd_writeBinFloat(file, (float) a[i]);
+    e = svd_writeBinInt(file, n);
+    e |= svd_writeBinFloats(file, a, n);
   } else {
     fprintf(file, "%d\n", n);
-    for (i = 0; i < n; i++)
-      fprintf(file, "%g\n", a[i]);
+    e = writeValues(file, a, n, 1);
   }
-  svd_closeFile(file);
+  e |= closeWritten(file, filename);
+  return e;
 }
 
 double *svdLoadDenseArray(char *filename, int *np, char binary) {
@@ -231,11 +552,8 @@ double *svdLoadDenseArray(char *filename, int *np, char binary) {
   a = svd_doubleArray(n, FALSE, "svdLoadDenseArray: a");
   if (!a) return NULL;
   if (binary) {
-    float f;
-    for (i = 0; i < n; i++) {
-      svd_readBinFloat(file, &f);
-      a[i] = f;
-    }
+    if (svd_readBinFloats(file, a, n))
+      svd_error("svdLoadDenseArray: error reading %s", filename);
   } else {
     for (i = 0; i < n; i++) {
       if (fscanf(file, " %lf\n", a + i) != 1) {
@@ -255,6 +573,7 @@ double *svdLoadDenseArray(char *filename, int *np, char binary) {
 static SMat svdLoadSparseTextHBFile(FILE *file) {
   char line[128];
   long i, x, rows, cols, vals, num_mat;
+  struct svd_scan *scan;
   SMat S;
   /* Skip the header line: */
   if (!fgets(line, 128, file));
@@ -276,12 +595,16 @@ static SMat svdLoadSparseTextHBFile(FILE *file) {
   
   S = svdNewSMat(rows, cols, vals);
   if (!S) return NULL;
+  if (!(scan = svd_scanOpen(file))) {
+    svdFreeSMat(S);
+    return NULL;
+  }
   
   /* Read column pointers. */
   for (i = 0; i <= S->cols; i++) {
-    if (fscanf(file, " %ld", &x) != 1) {
+    if (svd_scanLong(scan, &x)) {
       svd_error("svdLoadSparseTextHBFile: error reading pointr %d", i);
-      return NULL;
+      goto fail;
     }
     S->pointr[i] = x - 1;
   }
@@ -289,21 +612,28 @@ static SMat svdLoadSparseTextHBFile(FILE *file) {
   
   /* Read row indices. */
   for (i = 0; i < S->vals; i++) {
-    if (fscanf(file, " %ld", &x) != 1) {
+    if (svd_scanLong(scan, &x)) {
       svd_error("svdLoadSparseTextHBFile: error reading rowind %d", i);
-      return NULL;
+      goto fail;
     }
     S->rowind[i] = x - 1;
   }
   for (i = 0; i < S->vals; i++) 
-    if (fscanf(file, " %lf", S->value + i) != 1) {
+    if (svd_scanDouble(scan, S->value + i)) {
       svd_error("svdLoadSparseTextHBFile: error reading value %d", i);
-      return NULL;
+      goto fail;
     }
+  svd_scanClose(scan);
   return S;
+
+ fail:
+  svd_scanClose(scan);
+  svdFreeSMat(S);
+  return NULL;
 }
 
-static void svdWriteSparseTextHBFile(SMat S, FILE *file) {
+static char svdWriteSparseTextHBFile(SMat S, FILE *file) {
+  char e;
   int i;
   long col_lines = ((S->cols + 1) / 8) + (((S->cols + 1) % 8) ? 1 : 0);
   long row_lines = (S->vals / 8) + ((S->vals % 8) ? 1 : 0);
@@ -324,135 +654,357 @@ static void svdWriteSparseTextHBFile(SMat S, FILE *file) {
   for (i = 0; i < S->vals; i++)
     fprintf(file, "%ld%s", S->rowind[i] + 1, (((i+1) % 8) == 0) ? "\n" : " ");
   fprintf(file, "\n");
-  for (i = 0; i < S->vals; i++)
-    fprintf(file, "%g%s", S->value[i], (((i+1) % 8) == 0) ? "\n" : " ");
+  e = writeValues(file, S->value, S->vals, 8);
   fprintf(file, "\n");
+  return e;
 }
 
 
 static SMat svdLoadSparseTextFile(FILE *file) {
   long c, i, n, v, rows, cols, vals;
-  SMat S;
-  if (fscanf(file, " %ld %ld %ld", &rows, &cols, &vals) != 3) {
-    svd_error("svdLoadSparseTextFile: bad file format");
-    return NULL;
-  }
+  struct svd_scan *scan;
+  SMat S = NULL;
+  if (!(scan = svd_scanOpen(file))) return NULL;
+  if (svd_scanLong(scan, &rows) || svd_scanLong(scan, &cols) || 
+      svd_scanLong(scan, &vals)) goto fail;
 
   S = svdNewSMat(rows, cols, vals);
-  if (!S) return NULL;
+  if (!S) {
+    svd_scanClose(scan);
+    return NULL;
+  }
   
   for (c = 0, v = 0; c < cols; c++) {
-    if (fscanf(file, " %ld", &n) != 1) {
-      svd_error("svdLoadSparseTextFile: bad file format");
-      return NULL;
-    }
+    if (svd_scanLong(scan, &n) || v + n > vals) goto fail;
     S->pointr[c] = v;
-    for (i = 0; i < n; i++, v++) {
-      if (fscanf(file, " %ld %lf", S->rowind + v, S->value + v) != 2) {
-        svd_error("svdLoadSparseTextFile: bad file format");
-        return NULL;
-      }
-    }
+    for (i = 0; i < n; i++, v++)
+      if (svd_scanLong(scan, S->rowind + v) || 
+          svd_scanDouble(scan, S->value + v)) goto fail;
   }
   S->pointr[cols] = vals;
+  svd_scanClose(scan);
   return S;
+
+ fail:
+  svd_error("svdLoadSparseTextFile: bad file format");
+  svd_scanClose(scan);
+  svdFreeSMat(S);
+  return NULL;
 }
 
 static void svdWriteSparseTextFile(SMat S, FILE *file) {
-  int c, v;
+  char x[SVD_NUMBER_LEN];
+  long c, v;
   fprintf(file, "%ld %ld %ld\n", S->rows, S->cols, S->vals);
   for (c = 0, v = 0; c < S->cols; c++) {
     fprintf(file, "%ld\n", S->pointr[c + 1] - S->pointr[c]);
-    for (; v < S->pointr[c+1]; v++)
-      fprintf(file, "%ld %g\n", S->rowind[v], S->value[v]);
+    for (; v < S->pointr[c+1]; v++) {
+      svd_formatDouble(x, S->value[v], (int) SVDPrecision);
+      fprintf(file, "%ld %s\n", S->rowind[v], x);
+    }
   }
 }
 
 
+/* Each column's row indices and values alternate, so they are read in
+   blocks of pairs and then pulled apart. */
+#define SB_PAIRS (1 << 17)
+
 static SMat svdLoadSparseBinaryFile(FILE *file) {
-  int rows, cols, vals, n, c, i, v, r, e = 0;
-  float f;
-  SMat S;
+  int rows, cols, vals, n, c, e = 0;
+  long i, m, v;
+  uint32_t *w = NULL;
+  SMat S = NULL;
   e += svd_readBinInt(file, &rows);
   e += svd_readBinInt(file, &cols);
   e += svd_readBinInt(file, &vals);
-  if (e) {
-    svd_error("svdLoadSparseBinaryFile: bad file format");
-    return NULL;
-  }
+  if (e) goto fail;
 
   S = svdNewSMat(rows, cols, vals);
-  if (!S) return NULL;
+  w = (uint32_t *) malloc(2 * SB_PAIRS * sizeof(uint32_t));
+  if (!S || !w) {
+    svdFreeSMat(S);
+    SAFE_FREE(w);
+    return NULL;
+  }
   
   for (c = 0, v = 0; c < cols; c++) {
-    if (svd_readBinInt(file, &n)) {
-      svd_error("svdLoadSparseBinaryFile: bad file format");
-      return NULL;
-    }
+    if (svd_readBinInt(file, &n) || n < 0 || v + n > vals) goto fail;
     S->pointr[c] = v;
-    for (i = 0; i < n; i++, v++) {
-      e += svd_readBinInt(file, &r);
-      e += svd_readBinFloat(file, &f);
-      if (e) {
-        svd_error("svdLoadSparseBinaryFile: bad file format");
-        return NULL;
+    for (; n > 0; n -= m) {
+      m = (n < SB_PAIRS) ? n : SB_PAIRS;
+      if (svd_readBinWords(file, w, 2 * m)) goto fail;
+      for (i = 0; i < m; i++, v++) {
+        S->rowind[v] = (int32_t) w[2 * i];
+        S->value[v] = ((float *) w)[2 * i + 1];
       }
-      S->rowind[v] = r;
-      S->value[v] = f;
     }
   }
   S->pointr[cols] = vals;
+  free(w);
   return S;
+
+ fail:
+  svd_error("svdLoadSparseBinaryFile: bad file format");
+  svdFreeSMat(S);
+  SAFE_FREE(w);
+  return NULL;
 }
 
-static void svdWriteSparseBinaryFile(SMat S, FILE *file) {
-  int c, v;
+static char svdWriteSparseBinaryFile(SMat S, FILE *file) {
+  long c, i, m, v;
+  uint32_t *w;
+  if (S->rows > INT_MAX || S->cols > INT_MAX || S->vals > INT_MAX) {
+    svd_error("svdWriteSparseBinaryFile: matrix too large, use sb2");
+    return TRUE;
+  }
+  if (!(w = (uint32_t *) malloc(2 * SB_PAIRS * sizeof(uint32_t)))) {
+    svd_error("svdWriteSparseBinaryFile: out of memory");
+    return TRUE;
+  }
   svd_writeBinInt(file, (int) S->rows);
   svd_writeBinInt(file, (int) S->cols);
   svd_writeBinInt(file, (int) S->vals);
   for (c = 0, v = 0; c < S->cols; c++) {
     svd_writeBinInt(file, (int) (S->pointr[c + 1] - S->pointr[c]));
-    for (; v < S->pointr[c+1]; v++) {
-      svd_writeBinInt(file, (int) S->rowind[v]);
-      svd_writeBinFloat(file, (float) S->value[v]);
+    for (; v < S->pointr[c+1]; v += m) {
+      m = S->pointr[c+1] - v;
+      if (m > SB_PAIRS) m = SB_PAIRS;
+      for (i = 0; i < m; i++) {
+        w[2 * i] = (uint32_t) S->rowind[v + i];
+        ((float *) w)[2 * i + 1] = (float) S->value[v + i];
+      }
+      svd_writeBinWords(file, w, 2 * m);
     }
   }
+  free(w);
+  return FALSE;
 }
 
 
-static DMat svdLoadDenseTextFile(FILE *file) {
-  long rows, cols, i, j;
-  DMat D;
-  if (fscanf(file, " %ld %ld", &rows, &cols) != 2) {
-    svd_error("svdLoadDenseTextFile: bad file format");
+/* The SBM format is a 64-byte header followed by the pointr, rowind and value
+   arrays exactly as they are held in memory, each starting on a multiple of 
+   64 bytes, so that the file can be mapped and used in place. */
+#define SBM_MAGIC "SVD_SBM\n"
+#define SBM_VERSION 1
+#define SBM_ORDER 0x01020304
+#define SBM_ALIGN(x) (((x) + 63) & ~(int64_t) 63)
+
+struct sbmHeader {
+  char magic[8];
+  int32_t version;
+  int32_t byteOrder;             /* SBM_ORDER as stored by the writer. */
+  int64_t rows, cols, vals;
+  int64_t pointr, rowind, value; /* File offsets of the arrays. */
+};
+
+static void sbmLayout(struct sbmHeader *H, long rows, long cols, long vals) {
+  memset(H, 0, sizeof(struct sbmHeader));
+  memcpy(H->magic, SBM_MAGIC, 8);
+  H->version = SBM_VERSION;
+  H->byteOrder = SBM_ORDER;
+  H->rows = rows;
+  H->cols = cols;
+  H->vals = vals;
+  H->pointr = SBM_ALIGN(sizeof(struct sbmHeader));
+  H->rowind = SBM_ALIGN(H->pointr + (cols + 1) * sizeof(int64_t));
+  H->value  = SBM_ALIGN(H->rowind + vals * sizeof(int64_t));
+}
+
+static void swap8(void *a, long n) {
+  uint64_t *x = (uint64_t *) a;
+  for (; n > 0; n--, x++) *x = __builtin_bswap64(*x);
+}
+
+/* Returns 0 if the header is usable, setting swap if it was written with 
+   the other byte order. */
+static int sbmCheckHeader(struct sbmHeader *H, char *swap) {
+  struct sbmHeader L;
+  if (memcmp(H->magic, SBM_MAGIC, 8)) return 1;
+  *swap = (H->byteOrder != SBM_ORDER);
+  if (*swap) {
+    if (H->byteOrder != (int32_t) __builtin_bswap32(SBM_ORDER)) return 1;
+    H->version = __builtin_bswap32(H->version);
+    swap8(&H->rows, 6);
+  }
+  if (H->version != SBM_VERSION || sizeof(long) != sizeof(int64_t) ||
+      H->rows < 0 || H->cols < 0 || H->vals < 0) return 1;
+  sbmLayout(&L, H->rows, H->cols, H->vals);
+  return (L.pointr != H->pointr || L.rowind != H->rowind || 
+          L.value != H->value);
+}
+
+/* Returns TRUE unless the column pointers run without decreasing from 0 to
+   S->vals, as svdLAS2 assumes without checking. */
+static char badPointers(SMat S) {
+  long c;
+  if (S->pointr[0] != 0 || S->pointr[S->cols] != S->vals) return TRUE;
+  for (c = 0; c < S->cols; c++)
+    if (S->pointr[c + 1] < S->pointr[c]) return TRUE;
+  return FALSE;
+}
+
+/* As badPointers, but also returns TRUE unless every row index is in 
+   [0, S->rows). */
+static char badIndices(SMat S) {
+  long i;
+  if (badPointers(S)) return TRUE;
+  for (i = 0; i < S->vals; i++)
+    if (S->rowind[i] < 0 || S->rowind[i] >= S->rows) return TRUE;
+  return FALSE;
+}
+
+/* Maps an SBM file written in the native byte order and returns a matrix
+   whose arrays point into the mapping.  The mapping is private, so 
+   changes to the matrix are not written back.  Returns NULL, without 
+   complaint, if the file can't be used this way, so that it can be read 
+   as a stream instead.  Only the column pointers are checked unless 
+   checkRows is set, since checking the row indices would read half the 
+   file before it is used. */
+static SMat svdMapSparseBinaryFile(char *filename, char checkRows) {
+  struct sbmHeader H;
+  struct stat st;
+  char swap;
+  void *map;
+  long size;
+  int fd;
+  SMat S;
+
+  /* A compressed file fails the header check. */
+  if (!strcmp(filename, "-") || filename[0] == '|') return NULL;
+  if ((fd = open(filename, O_RDONLY)) < 0) return NULL;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || 
+      st.st_size < (off_t) sizeof(H) || 
+      read(fd, &H, sizeof(H)) != sizeof(H) || sbmCheckHeader(&H, &swap) || 
+      swap) {
+    close(fd);
+    return NULL;
+  }
+  size = H.value + H.vals * sizeof(double);
+  if (st.st_size < size) {
+    close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return NULL;
+
+  if (!(S = (SMat) calloc(1, sizeof(struct smat)))) {
+    munmap(map, size);
+    return NULL;
+  }
+  S->rows = H.rows;
+  S->cols = H.cols;
+  S->vals = H.vals;
+  S->pointr = (long *) ((char *) map + H.pointr);
+  S->rowind = (long *) ((char *) map + H.rowind);
+  S->value = (double *) ((char *) map + H.value);
+  S->map = map;
+  S->mapSize = size;
+  if ((checkRows) ? badIndices(S) : badPointers(S)) {
+    svd_error("svdLoadSparseMatrix: bad indices in %s", filename);
+    svdFreeSMat(S);
+    return NULL;
+  }
+  return S;
+}
+
+/* Skips forward to offset in a stream that may not be seekable. */
+static int sbmSkip(FILE *file, int64_t *at, int64_t offset) {
+  for (; *at < offset; (*at)++)
+    if (getc(file) == EOF) return 1;
+  return 0;
+}
+
+/* Reads an SBM file from a stream, such as a pipe or a compressed file, or 
+   one written with the other byte order. */
+static SMat svdLoadSparseBinaryMappedFile(FILE *file) {
+  struct sbmHeader H;
+  int64_t at = sizeof(H);
+  char swap;
+  SMat S;
+
+  if (fread(&H, sizeof(H), 1, file) != 1 || sbmCheckHeader(&H, &swap)) {
+    svd_error("svdLoadSparseBinaryMappedFile: bad file format");
     return NULL;
   }
+  S = svdNewSMat(H.rows, H.cols, H.vals);
+  if (!S) return NULL;
+  if (sbmSkip(file, &at, H.pointr) ||
+      fread(S->pointr, sizeof(long), S->cols + 1, file) != 
+      (size_t) S->cols + 1) goto fail;
+  at += (S->cols + 1) * sizeof(long);
+  if (sbmSkip(file, &at, H.rowind) ||
+      fread(S->rowind, sizeof(long), S->vals, file) != (size_t) S->vals)
+    goto fail;
+  at += S->vals * sizeof(long);
+  if (sbmSkip(file, &at, H.value) ||
+      fread(S->value, sizeof(double), S->vals, file) != (size_t) S->vals)
+    goto fail;
+  if (swap) {
+    swap8(S->pointr, S->cols + 1);
+    swap8(S->rowind, S->vals);
+    swap8(S->value, S->vals);
+  }
+  if (badIndices(S)) goto fail;
+  return S;
+
+ fail:
+  svd_error("svdLoadSparseBinaryMappedFile: bad file format");
+  svdFreeSMat(S);
+  return NULL;
+}
+
+static void svdWriteSparseBinaryMappedFile(SMat S, FILE *file) {
+  struct sbmHeader H;
+  int64_t at;
+  sbmLayout(&H, S->rows, S->cols, S->vals);
+  fwrite(&H, sizeof(H), 1, file);
+  for (at = sizeof(H); at < H.pointr; at++) putc(0, file);
+  fwrite(S->pointr, sizeof(long), S->cols + 1, file);
+  for (at += (S->cols + 1) * sizeof(long); at < H.rowind; at++) putc(0, file);
+  fwrite(S->rowind, sizeof(long), S->vals, file);
+  for (at += S->vals * sizeof(long); at < H.value; at++) putc(0, file);
+  fwrite(S->value, sizeof(double), S->vals, file);
+}
+
+
+static DMat svdLoadDenseTextFile(FILE *file) {
+  long rows, cols, i, j;
+  struct svd_scan *scan;
+  DMat D = NULL;
+  if (!(scan = svd_scanOpen(file))) return NULL;
+  if (svd_scanLong(scan, &rows) || svd_scanLong(scan, &cols)) goto fail;
 
   D = svdNewDMat(rows, cols);
-  if (!D) return NULL;
+  if (!D) {
+    svd_scanClose(scan);
+    return NULL;
+  }
 
   for (i = 0; i < rows; i++)
-    for (j = 0; j < cols; j++) {
-      if (fscanf(file, " %lf", &(D->value[i][j])) != 1) {
-        svd_error("svdLoadDenseTextFile: bad file format");
-        return NULL;
-      }
-    }
+    for (j = 0; j < cols; j++)
+      if (svd_scanDouble(scan, &(D->value[i][j]))) goto fail;
+  svd_scanClose(scan);
   return D;
+
+ fail:
+  svd_error("svdLoadDenseTextFile: bad file format");
+  svd_scanClose(scan);
+  if (D) svdFreeDMat(D);
+  return NULL;
 }
 
-static void svdWriteDenseTextFile(DMat D, FILE *file) {
-  int i, j;
+static char svdWriteDenseTextFile(DMat D, FILE *file) {
   fprintf(file, "%ld %ld\n", D->rows, D->cols);
-  for (i = 0; i < D->rows; i++)
-    for (j = 0; j < D->cols; j++) 
-      fprintf(file, "%g%c", D->value[i][j], (j == D->cols - 1) ? '\n' : ' ');
+  if (D->rows && D->cols) 
+    return writeValues(file, D->value[0], D->rows * D->cols, D->cols);
+  return FALSE;
 }
 
 
 static DMat svdLoadDenseBinaryFile(FILE *file) {
-  int rows, cols, i, j, e = 0;
-  float f;
+  int rows, cols, e = 0;
   DMat D;
   e += svd_readBinInt(file, &rows);
   e += svd_readBinInt(file, &cols);
@@ -464,129 +1016,1428 @@ static DMat svdLoadDenseBinaryFile(FILE *file) {
   D = svdNewDMat(rows, cols);
   if (!D) return NULL;
 
-  for (i = 0; i < rows; i++)
-    for (j = 0; j < cols; j++) {
-      if (svd_readBinFloat(file, &f)) {
-        svd_error("svdLoadDenseBinaryFile: bad file format");
-        return NULL;
-      }
-      D->value[i][j] = f;
-    }
+  if (svd_readBinFloats(file, D->value[0], (long) rows * cols)) {
+    svd_error("svdLoadDenseBinaryFile: bad file format");
+    svdFreeDMat(D);
+    return NULL;
+  }
   return D;
 }
 
-static void svdWriteDenseBinaryFile(DMat D, FILE *file) {
-  int i, j;
+static char svdWriteDenseBinaryFile(DMat D, FILE *file) {
   svd_writeBinInt(file, (int) D->rows);
   svd_writeBinInt(file, (int) D->cols);
-  for (i = 0; i < D->rows; i++)
-    for (j = 0; j < D->cols; j++) 
-      svd_writeBinFloat(file, (float) D->value[i][j]);
+  return svd_writeBinFloats(file, D->value[0], D->rows * D->cols);
 }
 
 
-SMat svdLoadSparseMatrix(char *filename, int format) {
+/* The sb2 and db2 formats start with a magic string, a version, the size
+   of each value, and 8-byte counts, all in network order like sb and db.  
+   sb2 files then hold the column starts, row indices and values as whole 
+   arrays, and db2 files the values row by row.  Values are 8-byte doubles,
+   or 4-byte floats if SVDBinaryFloat was set when the file was written. */
+
+#define SB2_MAGIC "SVD_SB2\n"
+#define DB2_MAGIC "SVD_DB2\n"
+#define B2_VERSION 1
+
+static char b2ReadHeader(FILE *file, const char *magic, long *rows, 
+                         long *cols, long *vals, int *valueBytes) {
+  char m[8];
+  long counts[3];
+  int version;
+  if (fread(m, 1, 8, file) != 8 || memcmp(m, magic, 8) || 
+      svd_readBinInt(file, &version) || version != B2_VERSION ||
+      svd_readBinInt(file, valueBytes) || 
+      (*valueBytes != 4 && *valueBytes != 8) ||
+      svd_readBinLongs(file, counts, 3) || counts[0] < 0 || counts[1] < 0 ||
+      counts[2] < 0) return TRUE;
+  *rows = counts[0];
+  *cols = counts[1];
+  *vals = counts[2];
+  return FALSE;
+}
+
+static void b2WriteHeader(FILE *file, const char *magic, long rows, long cols,
+                          long vals) {
+  long counts[3];
+  counts[0] = rows;
+  counts[1] = cols;
+  counts[2] = vals;
+  fwrite(magic, 1, 8, file);
+  svd_writeBinInt(file, B2_VERSION);
+  svd_writeBinInt(file, (SVDBinaryFloat) ? 4 : 8);
+  svd_writeBinLongs(file, counts, 3);
+}
+
+static char b2ReadValues(FILE *file, double *a, long n, int valueBytes) {
+  if (valueBytes == 4) return svd_readBinFloats(file, a, n);
+  return svd_readBinDoubles(file, a, n);
+}
+
+static char b2WriteValues(FILE *file, const double *a, long n) {
+  if (SVDBinaryFloat) return svd_writeBinFloats(file, a, n);
+  return svd_writeBinDoubles(file, a, n);
+}
+
+static SMat svdLoadSparseBinary2File(FILE *file) {
+  long rows, cols, vals;
+  int valueBytes;
   SMat S = NULL;
-  DMat D = NULL;
-  FILE *file = svd_fatalReadFile(filename);
-  switch (format) {
-  case SVD_F_STH: 
-    S = svdLoadSparseTextHBFile(file);
-    break;
-  case SVD_F_ST:
-    S = svdLoadSparseTextFile(file);
-    break;
-  case SVD_F_SB:
-    S = svdLoadSparseBinaryFile(file);
-    break;
-  case SVD_F_DT:
-    D = svdLoadDenseTextFile(file);
-    break;
-  case SVD_F_DB:
-    D = svdLoadDenseBinaryFile(file);
-    break;
-  default: svd_error("svdLoadSparseMatrix: unknown format %d", format);
-  }
-  svd_closeFile(file);
-  if (D) {
-    S = svdConvertDtoS(D);
-    svdFreeDMat(D);
-  }
+  if (b2ReadHeader(file, SB2_MAGIC, &rows, &cols, &vals, &valueBytes)) 
+    goto fail;
+  if (!(S = svdNewSMat(rows, cols, vals))) return NULL;
+  if (svd_readBinLongs(file, S->pointr, cols + 1) || 
+      svd_readBinLongs(file, S->rowind, vals) || 
+      b2ReadValues(file, S->value, vals, valueBytes)) goto fail;
+  if (badIndices(S)) goto fail;
   return S;
+
+ fail:
+  svd_error("svdLoadSparseBinary2File: bad file format");
+  svdFreeSMat(S);
+  return NULL;
 }
 
-DMat svdLoadDenseMatrix(char *filename, int format) {
-  SMat S = NULL;
-  DMat D = NULL;
-  FILE *file = svd_fatalReadFile(filename);
-  switch (format) {
-  case SVD_F_STH: 
-    S = svdLoadSparseTextHBFile(file);
-    break;
-  case SVD_F_ST:
-    S = svdLoadSparseTextFile(file);
-    break;
-  case SVD_F_SB:
-    S = svdLoadSparseBinaryFile(file);
-    break;
-  case SVD_F_DT:
-    D = svdLoadDenseTextFile(file);
-    break;
-  case SVD_F_DB:
-    D = svdLoadDenseBinaryFile(file);
-    break;
-  default: svd_error("svdLoadSparseMatrix: unknown format %d", format);
+static char svdWriteSparseBinary2File(SMat S, FILE *file) {
+  b2WriteHeader(file, SB2_MAGIC, S->rows, S->cols, S->vals);
+  return (svd_writeBinLongs(file, S->pointr, S->cols + 1) ||
+          svd_writeBinLongs(file, S->rowind, S->vals) ||
+          b2WriteValues(file, S->value, S->vals));
+}
+
+static DMat svdLoadDenseBinary2File(FILE *file) {
+  long rows, cols, vals;
+  int valueBytes;
+  DMat D;
+  if (b2ReadHeader(file, DB2_MAGIC, &rows, &cols, &vals, &valueBytes) ||
+      vals != rows * cols || rows > INT_MAX || cols > INT_MAX) {
+    svd_error("svdLoadDenseBinary2File: bad file format");
+    return NULL;
   }
-  svd_closeFile(file);
-  if (S) {
-    D = svdConvertStoD(S);
-    svdFreeSMat(S);
+  if (!(D = svdNewDMat(rows, cols))) return NULL;
+  if (b2ReadValues(file, D->value[0], vals, valueBytes)) {
+    svd_error("svdLoadDenseBinary2File: bad file format");
+    svdFreeDMat(D);
+    return NULL;
   }
   return D;
 }
 
-void svdWriteSparseMatrix(SMat S, char *filename, int format) {
-  DMat D = NULL;
-  FILE *file = svd_writeFile(filename, FALSE);
-  if (!file) {
-    svd_error("svdWriteSparseMatrix: failed to write file %s\n", filename);
-    return;
+static char svdWriteDenseBinary2File(DMat D, FILE *file) {
+  b2WriteHeader(file, DB2_MAGIC, D->rows, D->cols, D->rows * D->cols);
+  return b2WriteValues(file, D->value[0], D->rows * D->cols);
+}
+
+
+/* NumPy .npy files hold a magic string, a version, the length of a header
+   and the header itself, a Python dict giving the type, the order and the
+   shape, padded so the values start on a 64-byte boundary.  The values
+   follow in C (row major) order as little-endian doubles, or floats if 
+   SVDBinaryFloat is set, so NumPy can map them straight into an array. */
+#define NPY_MAGIC "\x93NUMPY"
+#define NPY_HEADER 256
+#define NPY_BLOCK (1 << 16)
+
+static char littleEndian(void) {
+  uint16_t x = 1;
+  return *((uint8_t *) &x);
+}
+
+/* Reads the header of a 2-D (or 1-D, taken as a column) array of doubles 
+   or floats in C order. */
+static char npyReadHeader(FILE *file, long *rows, long *cols, 
+                          int *valueBytes) {
+  unsigned char m[10];
+  char header[NPY_HEADER * 16], *s;
+  long length;
+  if (fread(m, 1, 10, file) != 10 || memcmp(m, NPY_MAGIC, 6)) return TRUE;
+  length = m[8] | (m[9] << 8);
+  if (m[6] > 1) {
+    unsigned char l[2];
+    if (fread(l, 1, 2, file) != 2) return TRUE;
+    length |= ((long) l[0] << 16) | ((long) l[1] << 24);
   }
-  switch (format) {
+  if (length >= (long) sizeof(header) || 
+      fread(header, 1, length, file) != (size_t) length) return TRUE;
+  header[length] = '\0';
+  if (strstr(header, "'<f8'")) *valueBytes = 8;
+  else if (strstr(header, "'<f4'")) *valueBytes = 4;
+  else return TRUE;
+  if (!(s = strstr(header, "'fortran_order':")) || 
+      strncmp(s + 16 + strspn(s + 16, " "), "False", 5)) return TRUE;
+  if (!(s = strstr(header, "'shape':")) || !(s = strchr(s, '('))) 
+    return TRUE;
+  if (sscanf(s, "( %ld , %ld )", rows, cols) != 2) {
+    if (sscanf(s, "( %ld , )", rows) != 1) return TRUE;
+    *cols = 1;
+  }
+  return (*rows < 0 || *cols < 0);
+}
+
+/* Writes the header of an array of rows by cols, or if cols is negative, a 
+   1-D array of rows values. */
+static void npyWriteHeader(FILE *file, long rows, long cols) {
+  char header[NPY_HEADER];
+  unsigned char m[10];
+  int n;
+  if (cols < 0)
+    n = sprintf(header, "{'descr': '%s', 'fortran_order': False, "
+                "'shape': (%ld,), }", (SVDBinaryFloat) ? "<f4" : "<f8", rows);
+  else
+    n = sprintf(header, "{'descr': '%s', 'fortran_order': False, "
+                "'shape': (%ld, %ld), }", (SVDBinaryFloat) ? "<f4" : "<f8", 
+                rows, cols);
+  while ((10 + n + 1) % 64) header[n++] = ' ';
+  header[n++] = '\n';
+  memcpy(m, NPY_MAGIC, 6);
+  m[6] = 1;
+  m[7] = 0;
+  m[8] = n & 0xff;
+  m[9] = n >> 8;
+  fwrite(m, 1, 10, file);
+  fwrite(header, 1, n, file);
+}
+
+static char npyReadValues(FILE *file, double *a, long n, int valueBytes) {
+  float *f;
+  long i, m;
+  char swap = !littleEndian();
+  if (valueBytes == 8) {
+    if (fread(a, sizeof(double), n, file) != (size_t) n) return TRUE;
+    if (swap) 
+      for (i = 0; i < n; i++) {
+        uint64_t w;
+        memcpy(&w, a + i, 8);
+        w = __builtin_bswap64(w);
+        memcpy(a + i, &w, 8);
+      }
+    return FALSE;
+  }
+  if (!(f = (float *) malloc(NPY_BLOCK * sizeof(float)))) return TRUE;
+  for (; n > 0; n -= m, a += m) {
+    m = (n < NPY_BLOCK) ? n : NPY_BLOCK;
+    if (fread(f, sizeof(float), m, file) != (size_t) m) break;
+    for (i = 0; i < m; i++) {
+      uint32_t w;
+      memcpy(&w, f + i, 4);
+      if (swap) w = __builtin_bswap32(w);
+      memcpy(f + i, &w, 4);
+      a[i] = f[i];
+    }
+  }
+  free(f);
+  return (n > 0);
+}
+
+/* Doubles on a little-endian machine are written as they lie. */
+static char npyWriteValues(FILE *file, const double *a, long n) {
+  char swap = !littleEndian();
+  uint64_t *w;
+  float *f;
+  long i, m;
+  if (!SVDBinaryFloat && !swap)
+    return (fwrite(a, sizeof(double), n, file) != (size_t) n);
+  if (!(w = (uint64_t *) malloc(NPY_BLOCK * sizeof(uint64_t)))) return TRUE;
+  f = (float *) w;
+  for (; n > 0; n -= m, a += m) {
+    m = (n < NPY_BLOCK) ? n : NPY_BLOCK;
+    if (SVDBinaryFloat) {
+      for (i = 0; i < m; i++) {
+        uint32_t x;
+        f[i] = (float) a[i];
+        memcpy(&x, f + i, 4);
+        if (swap) x = __builtin_bswap32(x);
+        memcpy(f + i, &x, 4);
+      }
+      if (fwrite(f, sizeof(float), m, file) != (size_t) m) break;
+    } else {
+      memcpy(w, a, m * sizeof(double));
+      for (i = 0; i < m; i++) w[i] = __builtin_bswap64(w[i]);
+      if (fwrite(w, sizeof(uint64_t), m, file) != (size_t) m) break;
+    }
+  }
+  free(w);
+  return (n > 0);
+}
+
+static DMat svdLoadDenseNumpyFile(FILE *file) {
+  long rows, cols;
+  int valueBytes;
+  DMat D;
+  if (npyReadHeader(file, &rows, &cols, &valueBytes) || rows > INT_MAX || 
+      cols > INT_MAX) {
+    svd_error("svdLoadDenseNumpyFile: bad file format");
+    return NULL;
+  }
+  if (!(D = svdNewDMat(rows, cols))) return NULL;
+  if (npyReadValues(file, D->value[0], rows * cols, valueBytes)) {
+    svd_error("svdLoadDenseNumpyFile: bad file format");
+    svdFreeDMat(D);
+    return NULL;
+  }
+  return D;
+}
+
+static char svdWriteDenseNumpyFile(DMat D, FILE *file) {
+  npyWriteHeader(file, D->rows, D->cols);
+  return npyWriteValues(file, D->value[0], D->rows * D->cols);
+}
+
+char svdWriteDenseArrayFormat(double *a, int n, char *filename, int format) {
+  FILE *file;
+  char e;
+  if (format != SVD_F_NPY)
+    return svdWriteDenseArray(a, n, filename, format == SVD_F_DB);
+  if (!(file = svd_writeFile(filename, FALSE))) {
+    svd_error("svdWriteDenseArrayFormat: failed to write %s", filename);
+    return TRUE;
+  }
+  npyWriteHeader(file, n, -1);
+  e = npyWriteValues(file, a, n);
+  e |= closeWritten(file, filename);
+  return e;
+}
+
+
+/* Matrix Market coordinate files hold a banner line, comment lines starting
+   with %, a line with the rows, columns and entries, and then one entry per
+   line as a 1-based row and column and, unless the field is pattern, a 
+   value.  The entries may come in any order, and entries at the same place
+   are summed.  A symmetric or skew-symmetric file holds only one triangle,
+   and the other is filled in.  Complex, hermitian and array files aren't
+   supported. */
+
+#define MM_BANNER "%%MatrixMarket"
+enum mmSymmetry {MM_GENERAL, MM_SYMMETRIC, MM_SKEW};
+
+/* Reads a line into buf, dropping whatever doesn't fit.  Returns TRUE at
+   the end of the file. */
+static char mmReadLine(FILE *file, char *buf, int size) {
+  int c;
+  if (!fgets(buf, size, file)) return TRUE;
+  if (!strchr(buf, '\n')) 
+    while ((c = getc(file)) != EOF && c != '\n');
+  return FALSE;
+}
+
+/* Reads everything up to the first entry.  Returns TRUE on failure. */
+static char mmReadHeader(FILE *file, long *rows, long *cols, long *nnz, 
+                         char *pattern, int *symmetry) {
+  char line[1024], object[64], format[64], field[64], sym[64];
+  if (mmReadLine(file, line, sizeof(line)) || 
+      strncasecmp(line, MM_BANNER, strlen(MM_BANNER)) ||
+      sscanf(line + strlen(MM_BANNER), "%63s %63s %63s %63s", 
+             object, format, field, sym) != 4) {
+    svd_error("mmReadHeader: missing %s banner", MM_BANNER);
+    return TRUE;
+  }
+  if (strcasecmp(object, "matrix") || strcasecmp(format, "coordinate")) {
+    svd_error("mmReadHeader: only coordinate matrices are supported");
+    return TRUE;
+  }
+  if (!strcasecmp(field, "real") || !strcasecmp(field, "integer")) 
+    *pattern = FALSE;
+  else if (!strcasecmp(field, "pattern")) *pattern = TRUE;
+  else {
+    svd_error("mmReadHeader: unsupported field %s", field);
+    return TRUE;
+  }
+  if (!strcasecmp(sym, "general")) *symmetry = MM_GENERAL;
+  else if (!strcasecmp(sym, "symmetric")) *symmetry = MM_SYMMETRIC;
+  else if (!strcasecmp(sym, "skew-symmetric")) *symmetry = MM_SKEW;
+  else {
+    svd_error("mmReadHeader: unsupported symmetry %s", sym);
+    return TRUE;
+  }
+  do {
+    if (mmReadLine(file, line, sizeof(line))) {
+      svd_error("mmReadHeader: missing size line");
+      return TRUE;
+    }
+  } while (line[0] == '%' || strspn(line, " \t\r\n") == strlen(line));
+  if (sscanf(line, "%ld %ld %ld", rows, cols, nnz) != 3 || *rows < 0 || 
+      *cols < 0 || *nnz < 0 || 
+      (*symmetry != MM_GENERAL && *rows != *cols)) {
+    svd_error("mmReadHeader: bad size line");
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* The triplets are put in order with two stable counting sorts, first by 
+   row and then by column, so the rows in each column come out sorted.  
+   Each sort splits the triplets into one chunk per thread.  The chunks 
+   count their keys, the counts are turned into an offset for each key in
+   each chunk, and then the chunks scatter their triplets in parallel. */
+struct mmSort {
+  long n, keys, chunks;
+  const long *key, *other;  /* The key to sort on and the other index. */
+  const double *value;
+  long *keyOut, *otherOut;  /* keyOut may be NULL. */
+  double *valueOut;
+  long *offset;             /* keys offsets for each chunk. */
+};
+
+static void mmCountChunk(long k, int thread, void *arg) {
+  struct mmSort *M = (struct mmSort *) arg;
+  long i, *count = M->offset + k * M->keys;
+  long end = (k + 1) * M->n / M->chunks;
+  for (i = k * M->n / M->chunks; i < end; i++) count[M->key[i]]++;
+}
+
+static void mmScatterChunk(long k, int thread, void *arg) {
+  struct mmSort *M = (struct mmSort *) arg;
+  long i, j, *offset = M->offset + k * M->keys;
+  long end = (k + 1) * M->n / M->chunks;
+  for (i = k * M->n / M->chunks; i < end; i++) {
+    j = offset[M->key[i]]++;
+    if (M->keyOut) M->keyOut[j] = M->key[i];
+    M->otherOut[j] = M->other[i];
+    M->valueOut[j] = M->value[i];
+  }
+}
+
+/* Sorts the triplets by key into the output arrays and fills pointr, if 
+   given, with the start of each key.  Returns TRUE if out of memory. */
+static char mmSort(struct mmSort *M, long *pointr) {
+  long c, k, sum;
+  M->chunks = svd_threads();
+  if (M->chunks > 1 && M->n < 10000) M->chunks = 1;
+  /* Each chunk costs an offset per key, so there are never more offsets 
+     than entries. */
+  if (M->keys > 0 && M->chunks * M->keys > M->n) 
+    M->chunks = svd_imax(1, M->n / M->keys);
+  M->offset = svd_longArray(M->chunks * M->keys, TRUE, "mmSort: offset");
+  if (!M->offset) return TRUE;
+  svd_parallel(M->chunks, mmCountChunk, M);
+  for (c = 0, sum = 0; c < M->keys; c++) {
+    if (pointr) pointr[c] = sum;
+    for (k = 0; k < M->chunks; k++) {
+      long n = M->offset[k * M->keys + c];
+      M->offset[k * M->keys + c] = sum;
+      sum += n;
+    }
+  }
+  if (pointr) pointr[M->keys] = sum;
+  svd_parallel(M->chunks, mmScatterChunk, M);
+  SAFE_FREE(M->offset);
+  return FALSE;
+}
+
+/* Sums the entries at the same place within each run of columns, moving 
+   the entries kept to the start of the run.  The runs are then closed up. */
+struct mmMerge {
+  SMat S;
+  long chunks, *first, *start, *kept;
+};
+
+static void mmMergeChunk(long k, int thread, void *arg) {
+  struct mmMerge *M = (struct mmMerge *) arg;
+  SMat S = M->S;
+  long c, i, v = M->start[k], end;
+  for (c = M->first[k]; c < M->first[k + 1]; c++) {
+    i = S->pointr[c];
+    end = (c + 1 < M->first[k + 1]) ? S->pointr[c + 1] : M->start[k + 1];
+    S->pointr[c] = v;
+    for (; i < end; i++) {
+      if (v > S->pointr[c] && S->rowind[v - 1] == S->rowind[i])
+        S->value[v - 1] += S->value[i];
+      else {
+        S->rowind[v] = S->rowind[i];
+        S->value[v++] = S->value[i];
+      }
+    }
+  }
+  M->kept[k] = v - M->start[k];
+}
+
+static char mmMerge(SMat S) {
+  struct mmMerge M;
+  long c, k, v, shift;
+  M.S = S;
+  M.chunks = (S->vals < 10000) ? 1 : svd_threads();
+  /* As in mmSort, a chunk should have at least a column's worth of 
+     entries. */
+  if (S->cols > 0 && M.chunks * S->cols > S->vals) 
+    M.chunks = svd_imax(1, S->vals / S->cols);
+  M.first = svd_longArray(M.chunks + 1, TRUE, "mmMerge: first");
+  M.start = svd_longArray(M.chunks + 1, TRUE, "mmMerge: start");
+  M.kept = svd_longArray(M.chunks, TRUE, "mmMerge: kept");
+  if (!M.first || !M.start || !M.kept) {
+    SAFE_FREE(M.first);
+    SAFE_FREE(M.start);
+    SAFE_FREE(M.kept);
+    return TRUE;
+  }
+  /* Split the columns into runs with about the same number of entries. */
+  for (k = 1, c = 0; k < M.chunks; k++) {
+    while (c < S->cols && S->pointr[c] < k * S->vals / M.chunks) c++;
+    M.first[k] = c;
+    M.start[k] = S->pointr[c];
+  }
+  M.first[M.chunks] = S->cols;
+  M.start[M.chunks] = S->vals;
+  svd_parallel(M.chunks, mmMergeChunk, &M);
+  for (k = 0, v = 0; k < M.chunks; k++) {
+    shift = M.start[k] - v;
+    if (shift) {
+      memmove(S->rowind + v, S->rowind + M.start[k], M.kept[k] * sizeof(long));
+      memmove(S->value + v, S->value + M.start[k], M.kept[k] * sizeof(double));
+      for (c = M.first[k]; c < M.first[k + 1]; c++) S->pointr[c] -= shift;
+    }
+    v += M.kept[k];
+  }
+  S->vals = S->pointr[S->cols] = v;
+  SAFE_FREE(M.first);
+  SAFE_FREE(M.start);
+  SAFE_FREE(M.kept);
+  return FALSE;
+}
+
+static SMat svdLoadMatrixMarketFile(FILE *file) {
+  long rows, cols, nnz, max, n = 0, r, c, i;
+  long *row = NULL, *col = NULL, *row2 = NULL, *col2 = NULL;
+  double x = 1.0, *value = NULL, *value2 = NULL;
+  struct svd_scan *scan = NULL;
+  struct mmSort M;
+  int symmetry;
+  char pattern;
+  SMat S = NULL;
+
+  if (mmReadHeader(file, &rows, &cols, &nnz, &pattern, &symmetry)) 
+    return NULL;
+  max = (symmetry == MM_GENERAL) ? nnz : 2 * nnz;
+  if (!(scan = svd_scanOpen(file)) || 
+      !(row = svd_longArray(max, FALSE, "svdLoadMatrixMarketFile: row")) ||
+      !(col = svd_longArray(max, FALSE, "svdLoadMatrixMarketFile: col")) ||
+      !(value = svd_doubleArray(max, FALSE, "svdLoadMatrixMarketFile: value")))
+    goto done;
+  for (i = 0; i < nnz; i++) {
+    if (svd_scanLong(scan, &r) || svd_scanLong(scan, &c) || 
+        (!pattern && svd_scanDouble(scan, &x))) {
+      svd_error("svdLoadMatrixMarketFile: bad file format");
+      goto done;
+    }
+    if (r < 1 || r > rows || c < 1 || c > cols) {
+      svd_error("svdLoadMatrixMarketFile: entry %ld %ld out of range", r, c);
+      goto done;
+    }
+    row[n] = r - 1;
+    col[n] = c - 1;
+    value[n++] = x;
+    if (symmetry != MM_GENERAL && r != c) {
+      row[n] = c - 1;
+      col[n] = r - 1;
+      value[n++] = (symmetry == MM_SKEW) ? -x : x;
+    }
+  }
+  svd_scanClose(scan);
+  scan = NULL;
+
+  if (!(row2 = svd_longArray(n, FALSE, "svdLoadMatrixMarketFile: row2")) ||
+      !(col2 = svd_longArray(n, FALSE, "svdLoadMatrixMarketFile: col2")) ||
+      !(value2 = svd_doubleArray(n, FALSE, "svdLoadMatrixMarketFile: value2")))
+    goto done;
+  M.n = n;
+  M.keys = rows;
+  M.key = row;
+  M.other = col;
+  M.value = value;
+  M.keyOut = row2;
+  M.otherOut = col2;
+  M.valueOut = value2;
+  if (mmSort(&M, NULL)) goto done;
+  SAFE_FREE(row);
+  SAFE_FREE(col);
+  SAFE_FREE(value);
+
+  if (!(S = svdNewSMat(rows, cols, n))) goto done;
+  M.keys = cols;
+  M.key = col2;
+  M.other = row2;
+  M.value = value2;
+  M.keyOut = NULL;
+  M.otherOut = S->rowind;
+  M.valueOut = S->value;
+  if (mmSort(&M, S->pointr) || mmMerge(S)) {
+    svdFreeSMat(S);
+    S = NULL;
+  }
+
+ done:
+  svd_scanClose(scan);
+  SAFE_FREE(row);
+  SAFE_FREE(col);
+  SAFE_FREE(value);
+  SAFE_FREE(row2);
+  SAFE_FREE(col2);
+  SAFE_FREE(value2);
+  return S;
+}
+
+static void svdWriteMatrixMarketFile(SMat S, FILE *file) {
+  char x[SVD_NUMBER_LEN];
+  long c, v;
+  fprintf(file, "%s matrix coordinate real general\n", MM_BANNER);
+  fprintf(file, "%ld %ld %ld\n", S->rows, S->cols, S->vals);
+  for (c = 0, v = 0; c < S->cols; c++)
+    for (; v < S->pointr[c+1]; v++) {
+      svd_formatDouble(x, S->value[v], (int) SVDPrecision);
+      fprintf(file, "%ld %ld %s\n", S->rowind[v] + 1, c + 1, x);
+    }
+}
+
+
+/* Large uncompressed ST and DT files are mapped and parsed in parallel.  
+   The text is cut into chunks at line starts, so this relies on the 
+   layout the writers produce: in ST files each column count and each 
+   entry on a line of its own, and in DT files one row per line.  A first
+   pass counts the columns or rows in each chunk, and a second parses 
+   each chunk straight into place.  If a file doesn't follow the layout, 
+   these return NULL and it is read as a stream instead. */
+
+#define PARALLEL_TEXT_MIN (1 << 20)  /* Smallest file worth parsing this way. */
+#define CHUNKS_PER_THREAD 4
+
+struct textChunks {
+  const char *data, *end;   /* The file, after its header line. */
+  const char **start;       /* start[i] to start[i+1] is chunk i. */
+  long *items, *count;      /* Columns or rows, and entries, per chunk. */
+  long cols;                /* Values per row, for DT. */
+  SMat S;
+  DMat D;
+  char failed;
+};
+
+static const char *mapTextFile(char *filename, long *size) {
+  struct stat st;
+  void *map;
+  int fd;
+  if (svd_threads() < 2 || !strcmp(filename, "-") || filename[0] == '|') 
+    return NULL;
+  if ((fd = open(filename, O_RDONLY)) < 0) return NULL;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || 
+      st.st_size < PARALLEL_TEXT_MIN) {
+    close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return NULL;
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  *size = st.st_size;
+  /* Anything compressed or binary would have failed the header parse. */
+  return (const char *) map;
+}
+
+static const char *skipSpace(const char *p, const char *end) {
+  while (p < end && isspace((unsigned char) *p)) p++;
+  return p;
+}
+
+/* Skips spaces and tabs to the end of the line.  Returns NULL if anything
+   else is left on it. */
+static const char *endOfLine(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+  if (p == end) return p;
+  return (*p == '\n') ? p + 1 : NULL;
+}
+
+static const char *nextLine(const char *p, const char *end) {
+  p = memchr(p, '\n', end - p);
+  return (p) ? p + 1 : end;
+}
+
+/* Returns the start of the first line at or after p that holds a single
+   token, which in an ST file is a column count. */
+static const char *nextColumn(const char *p, const char *end) {
+  const char *q;
+  for (; p < end; p = nextLine(p, end)) {
+    q = p;
+    while (q < end && (*q == ' ' || *q == '\t' || *q == '\r')) q++;
+    if (q == end || *q == '\n') continue;
+    while (q < end && !isspace((unsigned char) *q)) q++;
+    if (endOfLine(q, end)) return p;
+  }
+  return end;
+}
+
+static void countSparseChunk(long i, int thread, void *arg) {
+  struct textChunks *T = (struct textChunks *) arg;
+  const char *p = T->start[i], *end = T->start[i + 1];
+  long n, cols = 0, vals = 0;
+  while ((p = skipSpace(p, end)) < end) {
+    if (!(p = svd_parseLong(p, end, &n)) || n < 0 || !(p = endOfLine(p, end)))
+      break;
+    for (cols++, vals += n; n > 0 && p < end; n--) p = nextLine(p, end);
+    if (n) break;
+  }
+  if (p < end) T->failed = TRUE;
+  T->items[i] = cols;
+  T->count[i] = vals;
+}
+
+static void parseSparseChunk(long i, int thread, void *arg) {
+  struct textChunks *T = (struct textChunks *) arg;
+  const char *p = T->start[i], *end = T->start[i + 1];
+  long n, c = T->items[i], v = T->count[i];
+  SMat S = T->S;
+  while ((p = skipSpace(p, end)) < end) {
+    if (!(p = svd_parseLong(p, end, &n))) break;
+    S->pointr[c++] = v;
+    for (; n > 0; n--, v++) {
+      if ((p = skipSpace(p, end)) == end || 
+          !(p = svd_parseLong(p, end, S->rowind + v)) ||
+          (p = skipSpace(p, end)) == end ||
+          !(p = svd_parseDouble(p, end, S->value + v)) || 
+          !(p = endOfLine(p, end))) break;
+    }
+    if (n) break;
+  }
+  if (p < end) T->failed = TRUE;
+}
+
+static void countDenseChunk(long i, int thread, void *arg) {
+  struct textChunks *T = (struct textChunks *) arg;
+  const char *p = T->start[i], *end = T->start[i + 1];
+  long rows = 0;
+  for (; (p = skipSpace(p, end)) < end; p = nextLine(p, end)) rows++;
+  T->items[i] = rows;
+}
+
+static void parseDenseChunk(long i, int thread, void *arg) {
+  struct textChunks *T = (struct textChunks *) arg;
+  const char *p = T->start[i], *end = T->start[i + 1];
+  long r = T->items[i], j;
+  double *row;
+  while ((p = skipSpace(p, end)) < end) {
+    row = T->D->value[r++];
+    for (j = 0; j < T->cols; j++) {
+      if (!(p = svd_parseDouble(p, end, row + j))) break;
+      while (p < end && (*p == ' ' || *p == '\t')) p++;
+    }
+    if (j < T->cols || !(p = endOfLine(p, end))) break;
+  }
+  if (p < end) T->failed = TRUE;
+}
+
+/* Cuts the text after the header into chunks, with boundaries moved to the
+   next line start, or the next column count for ST, and sets up the 
+   arrays for the passes.  Returns the number of chunks. */
+static long splitText(struct textChunks *T, char sparse) {
+  long chunks = CHUNKS_PER_THREAD * svd_threads(), i;
+  long size = T->end - T->data;
+  T->start = (const char **) malloc((chunks + 1) * sizeof(char *));
+  T->items = svd_longArray(chunks + 1, TRUE, "splitText: items");
+  T->count = svd_longArray(chunks + 1, TRUE, "splitText: count");
+  if (!T->start || !T->items || !T->count) return 0;
+  T->start[0] = T->data;
+  for (i = 1; i < chunks; i++) {
+    const char *p = T->data + (size / chunks) * i;
+    if (p < T->start[i - 1]) p = T->start[i - 1];
+    else p = nextLine(p, T->end);
+    T->start[i] = (sparse) ? nextColumn(p, T->end) : p;
+  }
+  T->start[chunks] = T->end;
+  return chunks;
+}
+
+static void freeChunks(struct textChunks *T, long size) {
+  SAFE_FREE(T->start);
+  SAFE_FREE(T->items);
+  SAFE_FREE(T->count);
+  munmap((void *) T->data, size);
+}
+
+/* Turns per-chunk counts into offsets, returning the total. */
+static long prefixSum(long *a, long n) {
+  long i, t, sum = 0;
+  for (i = 0; i < n; i++) {
+    t = a[i];
+    a[i] = sum;
+    sum += t;
+  }
+  return sum;
+}
+
+static SMat svdLoadSparseTextParallel(char *filename) {
+  struct textChunks T;
+  long size, rows, cols, vals, chunks;
+  const char *map, *p;
+
+  memset(&T, 0, sizeof(T));
+  if (!(map = mapTextFile(filename, &size))) return NULL;
+  T.end = map + size;
+  if (!(p = svd_parseLong(skipSpace(map, T.end), T.end, &rows)) ||
+      !(p = svd_parseLong(skipSpace(p, T.end), T.end, &cols)) ||
+      !(p = svd_parseLong(skipSpace(p, T.end), T.end, &vals)) ||
+      !(T.data = endOfLine(p, T.end)) || !(chunks = splitText(&T, TRUE))) 
+    goto fail;
+
+  svd_parallel(chunks, countSparseChunk, &T);
+  if (T.failed || prefixSum(T.items, chunks) != cols || 
+      prefixSum(T.count, chunks) != vals ||
+      !(T.S = svdNewSMat(rows, cols, vals))) goto fail;
+  svd_parallel(chunks, parseSparseChunk, &T);
+  if (T.failed) goto fail;
+  T.S->pointr[cols] = vals;
+  freeChunks(&T, size);
+  return T.S;
+
+ fail:
+  if (T.S) svdFreeSMat(T.S);
+  freeChunks(&T, size);
+  return NULL;
+}
+
+static DMat svdLoadDenseTextParallel(char *filename) {
+  struct textChunks T;
+  long size, rows, chunks;
+  const char *map, *p;
+
+  memset(&T, 0, sizeof(T));
+  if (!(map = mapTextFile(filename, &size))) return NULL;
+  T.end = map + size;
+  if (!(p = svd_parseLong(skipSpace(map, T.end), T.end, &rows)) ||
+      !(p = svd_parseLong(skipSpace(p, T.end), T.end, &T.cols)) ||
+      !(T.data = endOfLine(p, T.end)) || !(chunks = splitText(&T, FALSE))) 
+    goto fail;
+
+  svd_parallel(chunks, countDenseChunk, &T);
+  if (prefixSum(T.items, chunks) != rows || 
+      !(T.D = svdNewDMat(rows, T.cols))) goto fail;
+  svd_parallel(chunks, parseDenseChunk, &T);
+  if (T.failed) goto fail;
+  freeChunks(&T, size);
+  return T.D;
+
+ fail:
+  if (T.D) svdFreeDMat(T.D);
+  freeChunks(&T, size);
+  return NULL;
+}
+
+
+/* A file name with wildcards that doesn't name a file itself is taken as a 
+   glob pattern for a set of shards, laid side by side in the order of their
+   names. */
+static char isPattern(char *filename) {
+  struct stat s;
+  return (filename[0] != '|' && strpbrk(filename, "*?[") && 
+          stat(filename, &s));
+}
+
+static char globShards(char *pattern, glob_t *G) {
+  if (glob(pattern, 0, NULL, G) || !G->gl_pathc) {
+    svd_error("no files match %s", pattern);
+    globfree(G);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+int svdLoadMatrixSize(char *filename, int format, long *rows, long *cols, 
+                      long *vals) {
+  char line[128];
+  int r, c, v, e = 0;
+  FILE *file;
+  if (isPattern(filename)) {
+    glob_t G;
+    long shardRows, shardCols, shardVals;
+    size_t i;
+    if (globShards(filename, &G)) return 1;
+    *cols = *vals = 0;
+    for (i = 0; i < G.gl_pathc && !e; i++) {
+      e = svdLoadMatrixSize(G.gl_pathv[i], format, &shardRows, &shardCols,
+                            &shardVals);
+      if (i && shardRows != *rows) e = 1;
+      *rows = shardRows;
+      *cols += shardCols;
+      *vals += shardVals;
+    }
+    globfree(&G);
+    return e;
+  }
+  if (!(file = svd_readFile(filename))) return 1;
+  switch (format) {
+  case SVD_F_STH:
+    if (!fgets(line, 128, file) || !fgets(line, 128, file) ||
+        fscanf(file, "%*s%ld%ld%ld", rows, cols, vals) != 3) e = 1;
+    break;
+  case SVD_F_ST:
+    if (fscanf(file, " %ld %ld %ld", rows, cols, vals) != 3) e = 1;
+    break;
+  case SVD_F_SB:
+    e += svd_readBinInt(file, &r);
+    e += svd_readBinInt(file, &c);
+    e += svd_readBinInt(file, &v);
+    *rows = r;
+    *cols = c;
+    *vals = v;
+    break;
+  case SVD_F_SBM: {
+    struct sbmHeader H;
+    char swap;
+    if (fread(&H, sizeof(H), 1, file) != 1 || sbmCheckHeader(&H, &swap)) 
+      e = 1;
+    else {
+      *rows = H.rows;
+      *cols = H.cols;
+      *vals = H.vals;
+    }
+    break;
+  }
+  case SVD_F_SB2:
+  case SVD_F_DB2: {
+    int valueBytes;
+    e = b2ReadHeader(file, (format == SVD_F_SB2) ? SB2_MAGIC : DB2_MAGIC, 
+                     rows, cols, vals, &valueBytes);
+    break;
+  }
+  case SVD_F_NPY: {
+    int valueBytes;
+    e = npyReadHeader(file, rows, cols, &valueBytes);
+    *vals = *rows * *cols;
+    break;
+  }
+  case SVD_F_MM: {
+    char pattern;
+    int symmetry;
+    if (mmReadHeader(file, rows, cols, vals, &pattern, &symmetry)) e = 1;
+    else if (symmetry != MM_GENERAL) *vals *= 2;
+    break;
+  }
+  case SVD_F_DT:
+    if (fscanf(file, " %ld %ld", rows, cols) != 2) e = 1;
+    else *vals = *rows * *cols;
+    break;
+  case SVD_F_DB:
+    e += svd_readBinInt(file, &r);
+    e += svd_readBinInt(file, &c);
+    *rows = r;
+    *cols = c;
+    *vals = *rows * *cols;
+    break;
+  default: 
+    svd_error("svdLoadMatrixSize: unknown format %d", format);
+    e = 1;
+  }
+  svd_closeFile(file);
+  if (e) svd_error("svdLoadMatrixSize: bad file format");
+  return (e != 0);
+}
+
+/* With SVDCacheDir set, a text matrix loaded as sparse is saved there as an
+   SBM sidecar, which later loads map instead of parsing the text.  The 
+   sidecar's name holds a hash of the file's real path and the format, and
+   the file's size and modification time, so that a changed file simply 
+   misses; its old sidecars are removed when the new one is written.  If 
+   SVDCacheLimit is positive, the least recently used sidecars are then 
+   removed until the cache holds no more than that many bytes. */
+#define CACHE_TEXT(f) ((f) == SVD_F_STH || (f) == SVD_F_ST || \
+                       (f) == SVD_F_DT || (f) == SVD_F_MM)
+#define CACHE_SUFFIX ".sbm"
+
+struct cacheKey {
+  char prefix[PATH_MAX], path[PATH_MAX];
+  struct stat st;
+};
+
+/* Fills in the sidecar path for a file, returning TRUE if it can't be 
+   cached, as for a pipe, stdin or a missing file. */
+static char cacheKey(char *filename, int format, struct cacheKey *K) {
+  char real[PATH_MAX], *c;
+  uint64_t hash = 14695981039346656037ULL;
+  if (!strcmp(filename, "-") || filename[0] == '|' || 
+      stat(filename, &K->st) || !S_ISREG(K->st.st_mode) || 
+      !realpath(filename, real)) return TRUE;
+  for (c = real; *c; c++) hash = (hash ^ (unsigned char) *c) * 1099511628211ULL;
+  if (snprintf(K->prefix, PATH_MAX, "%s/%016llx-%d-", SVDCacheDir, 
+               (unsigned long long) hash, format) >= PATH_MAX ||
+      snprintf(K->path, PATH_MAX, "%s%llx-%lld.%09ld" CACHE_SUFFIX, 
+               K->prefix, (unsigned long long) K->st.st_size, 
+               (long long) K->st.st_mtim.tv_sec, 
+               (long) K->st.st_mtim.tv_nsec) >= PATH_MAX) return TRUE;
+  return FALSE;
+}
+
+struct cacheEntry {
+  char *path;
+  off_t size;
+  time_t used;
+};
+
+static int olderEntry(const void *a, const void *b) {
+  time_t x = ((struct cacheEntry *) a)->used;
+  time_t y = ((struct cacheEntry *) b)->used;
+  return (x < y) ? -1 : (x > y);
+}
+
+/* Removes the stale sidecars of the file and, over the limit, the least 
+   recently used others, sparing the one just written. */
+static void cacheEvict(struct cacheKey *K) {
+  char pattern[PATH_MAX + 8];
+  struct cacheEntry *E;
+  struct stat st;
+  glob_t G;
+  long total = 0;
+  size_t i, n;
+  snprintf(pattern, sizeof(pattern), "%s*" CACHE_SUFFIX, K->prefix);
+  if (!glob(pattern, 0, NULL, &G)) {
+    for (i = 0; i < G.gl_pathc; i++)
+      if (strcmp(G.gl_pathv[i], K->path)) unlink(G.gl_pathv[i]);
+  }
+  globfree(&G);
+  if (SVDCacheLimit <= 0) return;
+  snprintf(pattern, sizeof(pattern), "%s/*" CACHE_SUFFIX, SVDCacheDir);
+  if (glob(pattern, 0, NULL, &G)) {
+    globfree(&G);
+    return;
+  }
+  if ((E = (struct cacheEntry *) calloc(G.gl_pathc, sizeof(*E)))) {
+    for (i = 0, n = 0; i < G.gl_pathc; i++) {
+      if (stat(G.gl_pathv[i], &st)) continue;
+      E[n].path = G.gl_pathv[i];
+      E[n].size = st.st_size;
+      E[n++].used = st.st_mtime;
+      total += st.st_size;
+    }
+    qsort(E, n, sizeof(*E), olderEntry);
+    for (i = 0; i < n && total > SVDCacheLimit; i++) {
+      if (!strcmp(E[i].path, K->path)) continue;
+      if (!unlink(E[i].path)) total -= E[i].size;
+    }
+    free(E);
+  }
+  globfree(&G);
+}
+
+/* Maps the sidecar if there is a good one, marking it as just used. */
+static SMat cacheLoad(struct cacheKey *K) {
+  SMat S = svdMapSparseBinaryFile(K->path, TRUE);
+  if (S) utimensat(AT_FDCWD, K->path, NULL, 0);
+  else if (!access(K->path, F_OK)) unlink(K->path);
+  return S;
+}
+
+/* Writes the sidecar under a temporary name and then renames it, so that a
+   reader never sees it half written.  Nothing is saved if the file changed
+   while it was being read. */
+static void cacheStore(SMat S, char *filename, struct cacheKey *K) {
+  char tmp[PATH_MAX + 32];
+  struct stat st;
+  FILE *file;
+  char e;
+  if (stat(filename, &st) || st.st_size != K->st.st_size ||
+      st.st_mtim.tv_sec != K->st.st_mtim.tv_sec || 
+      st.st_mtim.tv_nsec != K->st.st_mtim.tv_nsec) return;
+  mkdir(SVDCacheDir, 0777);
+  snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", K->path, (long) getpid());
+  if (!(file = fopen(tmp, "w"))) return;
+  svdWriteSparseBinaryMappedFile(S, file);
+  e = (ferror(file) != 0);
+  if (fclose(file) || e || rename(tmp, K->path)) {
+    unlink(tmp);
+    return;
+  }
+  cacheEvict(K);
+}
+
+static SMat loadSparseMatrix(char *filename, int format) {
+  SMat S = NULL;
+  DMat D = NULL;
+  FILE *file;
+  if (format == SVD_F_SBM && (S = svdMapSparseBinaryFile(filename, FALSE))) 
+    return S;
+  if (format == SVD_F_ST && (S = svdLoadSparseTextParallel(filename)))
+    return S;
+  if (format == SVD_F_DT && (D = svdLoadDenseTextParallel(filename))) {
+    S = svdConvertDtoS(D);
+    svdFreeDMat(D);
+    return S;
+  }
+  file = svd_fatalReadFile(filename);
+  switch (format) {
   case SVD_F_STH: 
-    svdWriteSparseTextHBFile(S, file);
+    S = svdLoadSparseTextHBFile(file);
+    break;
+  case SVD_F_ST:
+    S = svdLoadSparseTextFile(file);
+    break;
+  case SVD_F_SB:
+    S = svdLoadSparseBinaryFile(file);
+    break;
+  case SVD_F_SBM:
+    S = svdLoadSparseBinaryMappedFile(file);
+    break;
+  case SVD_F_MM:
+    S = svdLoadMatrixMarketFile(file);
+    break;
+  case SVD_F_SB2:
+    S = svdLoadSparseBinary2File(file);
+    break;
+  case SVD_F_DB2:
+    D = svdLoadDenseBinary2File(file);
+    break;
+  case SVD_F_NPY:
+    D = svdLoadDenseNumpyFile(file);
+    break;
+  case SVD_F_DT:
+    D = svdLoadDenseTextFile(file);
+    break;
+  case SVD_F_DB:
+    D = svdLoadDenseBinaryFile(file);
+    break;
+  default: svd_error("svdLoadSparseMatrix: unknown format %d", format);
+  }
+  svd_closeFile(file);
+  if (D) {
+    S = svdConvertDtoS(D);
+    svdFreeDMat(D);
+  }
+  return S;
+}
+
+SMat svdLoadSparseMatrix(char *filename, int format) {
+  struct cacheKey K;
+  SMat S;
+  if (isPattern(filename)) {
+    glob_t G;
+    if (globShards(filename, &G)) return NULL;
+    S = svdLoadSparseMatrices(G.gl_pathv, G.gl_pathc, format);
+    globfree(&G);
+    return S;
+  }
+  if (!SVDCacheDir || !CACHE_TEXT(format) || cacheKey(filename, format, &K))
+    return loadSparseMatrix(filename, format);
+  if ((S = cacheLoad(&K))) return S;
+  if ((S = loadSparseMatrix(filename, format))) cacheStore(S, filename, &K);
+  return S;
+}
+
+/* Shards are loaded on the thread pool and laid side by side, so they must
+   all have the same number of rows.  Where the header of each gives its 
+   exact number of nonzeros, the whole matrix is allocated first and each 
+   shard is copied in and freed as soon as it is loaded.  Otherwise (mm and
+   the dense formats) the shards are all loaded before being copied. */
+struct shards {
+  char **filenames;
+  int format;
+  SMat *S, N;
+  long rows, *cols, *vals, *firstCol, *firstVal;
+  char exact, failed;
+};
+
+#define EXACT_VALS(f) (SVD_IS_SPARSE(f) && (f) != SVD_F_MM)
+
+static void placeShard(struct shards *H, long i) {
+  SMat S = H->S[i], N = H->N;
+  long c;
+  for (c = 0; c < S->cols; c++)
+    N->pointr[H->firstCol[i] + c] = S->pointr[c] + H->firstVal[i];
+  memcpy(N->rowind + H->firstVal[i], S->rowind, S->vals * sizeof(long));
+  memcpy(N->value + H->firstVal[i], S->value, S->vals * sizeof(double));
+  svdFreeSMat(S);
+  H->S[i] = NULL;
+}
+
+static void loadShard(long i, int thread, void *arg) {
+  struct shards *H = (struct shards *) arg;
+  SMat S = svdLoadSparseMatrix(H->filenames[i], H->format);
+  H->S[i] = S;
+  if (!S || S->rows != H->rows || 
+      (H->exact && (S->cols != H->cols[i] || S->vals != H->vals[i]))) {
+    svd_error("svdLoadSparseMatrices: %s doesn't match the other shards", 
+              H->filenames[i]);
+    H->failed = TRUE;
+  } else if (H->exact) placeShard(H, i);
+}
+
+static void placeShardTask(long i, int thread, void *arg) {
+  placeShard((struct shards *) arg, i);
+}
+
+SMat svdLoadSparseMatrices(char **filenames, int count, int format) {
+  struct shards H;
+  long rows = 0, cols = 0, vals = 0, r, i;
+  if (count == 1) return svdLoadSparseMatrix(filenames[0], format);
+  memset(&H, 0, sizeof(struct shards));
+  H.filenames = filenames;
+  H.format = format;
+  H.exact = EXACT_VALS(format);
+  H.S = (SMat *) calloc(count, sizeof(SMat));
+  H.cols = svd_longArray(count, FALSE, "svdLoadSparseMatrices: cols");
+  H.vals = svd_longArray(count, FALSE, "svdLoadSparseMatrices: vals");
+  H.firstCol = svd_longArray(count, FALSE, "svdLoadSparseMatrices: firstCol");
+  H.firstVal = svd_longArray(count, FALSE, "svdLoadSparseMatrices: firstVal");
+  if (!H.S || !H.cols || !H.vals || !H.firstCol || !H.firstVal) goto fail;
+  for (i = 0; i < count; i++) {
+    if (svdLoadMatrixSize(filenames[i], format, &r, H.cols + i, H.vals + i))
+      goto fail;
+    if (i && r != rows) {
+      svd_error("svdLoadSparseMatrices: %s has %ld rows, not %ld", 
+                filenames[i], r, rows);
+      goto fail;
+    }
+    H.rows = rows = r;
+    H.firstCol[i] = cols;
+    H.firstVal[i] = vals;
+    cols += H.cols[i];
+    vals += H.vals[i];
+  }
+  if (H.exact && !(H.N = svdNewSMat(rows, cols, vals))) goto fail;
+  svd_parallel(count, loadShard, &H);
+  if (H.failed) goto fail;
+  if (!H.exact) {
+    for (i = 0, cols = 0, vals = 0; i < count; i++) {
+      H.firstCol[i] = cols;
+      H.firstVal[i] = vals;
+      cols += H.S[i]->cols;
+      vals += H.S[i]->vals;
+    }
+    if (!(H.N = svdNewSMat(rows, cols, vals))) goto fail;
+    svd_parallel(count, placeShardTask, &H);
+  }
+  H.N->pointr[cols] = vals;
+  goto done;
+
+ fail:
+  svdFreeSMat(H.N);
+  H.N = NULL;
+ done:
+  for (i = 0; H.S && i < count; i++) svdFreeSMat(H.S[i]);
+  SAFE_FREE(H.S);
+  SAFE_FREE(H.cols);
+  SAFE_FREE(H.vals);
+  SAFE_FREE(H.firstCol);
+  SAFE_FREE(H.firstVal);
+  return H.N;
+}
+
+/* Reads an ST or SB file twice to build its transpose.  The first pass
+   counts the entries in each row into N->pointr[r + 1], and the second
+   drops each entry into its row, so the original is never held. */
+static char transposeEntry(SMat N, char fill, long c, long r, double value) {
+  long j;
+  if (r < 0 || r >= N->cols) return TRUE;
+  if (!fill) N->pointr[r + 1]++;
+  else {
+    j = N->pointr[r + 1]++;
+    N->rowind[j] = c;
+    N->value[j] = value;
+  }
+  return FALSE;
+}
+
+static char transposeSparseTextFile(FILE *file, SMat *N) {
+  long c, i, n, r, v, rows, cols, vals;
+  double value;
+  char fill = (*N != NULL), e = TRUE;
+  struct svd_scan *scan;
+  if (!(scan = svd_scanOpen(file))) return TRUE;
+  if (svd_scanLong(scan, &rows) || svd_scanLong(scan, &cols) || 
+      svd_scanLong(scan, &vals)) goto done;
+  if (!fill && !(*N = svdNewSMat(cols, rows, vals))) goto done;
+  if ((*N)->rows != cols || (*N)->cols != rows || (*N)->vals != vals) 
+    goto done;
+  for (c = 0, v = 0; c < cols; c++) {
+    if (svd_scanLong(scan, &n) || v + n > vals) goto done;
+    for (i = 0; i < n; i++, v++)
+      if (svd_scanLong(scan, &r) || svd_scanDouble(scan, &value) ||
+          transposeEntry(*N, fill, c, r, value)) goto done;
+  }
+  e = FALSE;
+ done:
+  svd_scanClose(scan);
+  return e;
+}
+
+static char transposeSparseBinaryFile(FILE *file, SMat *N) {
+  int rows, cols, vals, n, c, e = 0;
+  long i, m, v;
+  char fill = (*N != NULL);
+  uint32_t *w;
+  e += svd_readBinInt(file, &rows);
+  e += svd_readBinInt(file, &cols);
+  e += svd_readBinInt(file, &vals);
+  if (e) return TRUE;
+  if (!fill && !(*N = svdNewSMat(cols, rows, vals))) return TRUE;
+  if ((*N)->rows != cols || (*N)->cols != rows || (*N)->vals != vals) 
+    return TRUE;
+  if (!(w = (uint32_t *) malloc(2 * SB_PAIRS * sizeof(uint32_t)))) 
+    return TRUE;
+  for (c = 0, v = 0; c < cols && !e; c++) {
+    if (svd_readBinInt(file, &n) || n < 0 || v + n > vals) e = 1;
+    for (; n > 0 && !e; n -= m) {
+      m = (n < SB_PAIRS) ? n : SB_PAIRS;
+      if (svd_readBinWords(file, w, 2 * m)) e = 1;
+      for (i = 0; i < m && !e; i++, v++)
+        e = transposeEntry(*N, fill, c, (int32_t) w[2 * i], 
+                           ((float *) w)[2 * i + 1]);
+    }
+  }
+  free(w);
+  return e;
+}
+
+SMat svdLoadTransposedSparseMatrix(char *filename, int format) {
+  SMat S, N = NULL;
+  FILE *file;
+  long r;
+  int pass;
+  char e = FALSE;
+  /* Pipes and stdin can't be read twice, nor are the other formats or 
+     shards streamed, so those are transposed in memory. */
+  if ((format != SVD_F_ST && format != SVD_F_SB) || !strcmp(filename, "-") ||
+      filename[0] == '|' || isPattern(filename)) {
+    if (!(S = svdLoadSparseMatrix(filename, format))) return NULL;
+    return svdTransposeSInPlace(S);
+  }
+  for (pass = 0; pass < 2 && !e; pass++) {
+    file = svd_fatalReadFile(filename);
+    e = (format == SVD_F_ST) ? transposeSparseTextFile(file, &N) :
+      transposeSparseBinaryFile(file, &N);
+    svd_closeFile(file);
+    if (pass || e) continue;
+    /* Turn the counts into the start of each row, one place to the right. */
+    for (r = 1; r <= N->cols; r++)
+      N->pointr[r] += N->pointr[r - 1];
+    for (r = N->cols; r > 0; r--)
+      N->pointr[r] = N->pointr[r - 1];
+    N->pointr[0] = 0;
+  }
+  if (e) {
+    svd_error("svdLoadTransposedSparseMatrix: bad file format in %s", 
+              filename);
+    svdFreeSMat(N);
+    return NULL;
+  }
+  return N;
+}
+
+DMat svdLoadDenseMatrix(char *filename, int format) {
+  SMat S = NULL;
+  DMat D = NULL;
+  FILE *file;
+  /* Shards are laid side by side as a sparse matrix first. */
+  if (isPattern(filename)) {
+    if (!(S = svdLoadSparseMatrix(filename, format))) return NULL;
+    D = svdConvertStoD(S);
+    svdFreeSMat(S);
+    return D;
+  }
+  if (format == SVD_F_DT && (D = svdLoadDenseTextParallel(filename)))
+    return D;
+  if (format == SVD_F_ST && (S = svdLoadSparseTextParallel(filename))) {
+    D = svdConvertStoD(S);
+    svdFreeSMat(S);
+    return D;
+  }
+  file = svd_fatalReadFile(filename);
+  switch (format) {
+  case SVD_F_STH: 
+    S = svdLoadSparseTextHBFile(file);
+    break;
+  case SVD_F_ST:
+    S = svdLoadSparseTextFile(file);
+    break;
+  case SVD_F_SB:
+    S = svdLoadSparseBinaryFile(file);
+    break;
+  case SVD_F_SBM:
+    S = svdLoadSparseBinaryMappedFile(file);
+    break;
+  case SVD_F_MM:
+    S = svdLoadMatrixMarketFile(file);
+    break;
+  case SVD_F_SB2:
+    S = svdLoadSparseBinary2File(file);
+    break;
+  case SVD_F_DB2:
+    D = svdLoadDenseBinary2File(file);
+    break;
+  case SVD_F_NPY:
+    D = svdLoadDenseNumpyFile(file);
+    break;
+  case SVD_F_DT:
+    D = svdLoadDenseTextFile(file);
+    break;
+  case SVD_F_DB:
+    D = svdLoadDenseBinaryFile(file);
+    break;
+  default: svd_error("svdLoadSparseMatrix: unknown format %d", format);
+  }
+  svd_closeFile(file);
+  if (S) {
+    D = svdConvertStoD(S);
+    svdFreeSMat(S);
+  }
+  return D;
+}
+
+char svdWriteSparseMatrix(SMat S, char *filename, int format) {
+  DMat D = NULL;
+  char e = FALSE;
+  FILE *file = svd_writeFile(filename, FALSE);
+  if (!file) {
+    svd_error("svdWriteSparseMatrix: failed to write file %s\n", filename);
+    return TRUE;
+  }
+  switch (format) {
+  case SVD_F_STH: 
+    e = svdWriteSparseTextHBFile(S, file);
     break;
   case SVD_F_ST:
     svdWriteSparseTextFile(S, file);
     break;
   case SVD_F_SB:
-    svdWriteSparseBinaryFile(S, file);
+    e = svdWriteSparseBinaryFile(S, file);
+    break;
+  case SVD_F_SBM:
+    svdWriteSparseBinaryMappedFile(S, file);
+    break;
+  case SVD_F_MM:
+    svdWriteMatrixMarketFile(S, file);
+    break;
+  case SVD_F_SB2:
+    e = svdWriteSparseBinary2File(S, file);
+    break;
+  case SVD_F_DB2:
+    D = svdConvertStoD(S);
+    e = svdWriteDenseBinary2File(D, file);
+    break;
+  case SVD_F_NPY:
+    D = svdConvertStoD(S);
+    e = svdWriteDenseNumpyFile(D, file);
     break;
   case SVD_F_DT:
     D = svdConvertStoD(S);
-    svdWriteDenseTextFile(D, file);
+    e = svdWriteDenseTextFile(D, file);
     break;
   case SVD_F_DB:
     D = svdConvertStoD(S);
-    svdWriteDenseBinaryFile(D, file);
+    e = svdWriteDenseBinaryFile(D, file);
     break;
   default: svd_error("svdLoadSparseMatrix: unknown format %d", format);
   }
-  svd_closeFile(file);
+  e |= closeWritten(file, filename);
   if (D) svdFreeDMat(D);
+  return e;
 }
 
-void svdWriteDenseMatrix(DMat D, char *filename, int format) {
+char svdWriteDenseMatrix(DMat D, char *filename, int format) {
   SMat S = NULL;
+  char e = FALSE;
   FILE *file = svd_writeFile(filename, FALSE);
   if (!file) {
     svd_error("svdWriteDenseMatrix: failed to write file %s\n", filename);
-    return;
+    return TRUE;
   }
   switch (format) {
   case SVD_F_STH: 
     S = svdConvertDtoS(D);
-    svdWriteSparseTextHBFile(S, file);
+    e = svdWriteSparseTextHBFile(S, file);
     break;
   case SVD_F_ST:
     S = svdConvertDtoS(D);
@@ -594,16 +2445,646 @@ void svdWriteDenseMatrix(DMat D, char *filename, int format) {
     break;
   case SVD_F_SB:
     S = svdConvertDtoS(D);
-    svdWriteSparseBinaryFile(S, file);
+    e = svdWriteSparseBinaryFile(S, file);
+    break;
+  case SVD_F_SBM:
+    S = svdConvertDtoS(D);
+    svdWriteSparseBinaryMappedFile(S, file);
+    break;
+  case SVD_F_MM:
+    S = svdConvertDtoS(D);
+    svdWriteMatrixMarketFile(S, file);
+    break;
+  case SVD_F_SB2:
+    S = svdConvertDtoS(D);
+    e = svdWriteSparseBinary2File(S, file);
+    break;
+  case SVD_F_DB2:
+    e = svdWriteDenseBinary2File(D, file);
+    break;
+  case SVD_F_NPY:
+    e = svdWriteDenseNumpyFile(D, file);
     break;
   case SVD_F_DT:
-    svdWriteDenseTextFile(D, file);
+    e = svdWriteDenseTextFile(D, file);
     break;
   case SVD_F_DB:
-    svdWriteDenseBinaryFile(D, file);
+    e = svdWriteDenseBinaryFile(D, file);
     break;
   default: svd_error("svdLoadSparseMatrix: unknown format %d", format);
   }
-  svd_closeFile(file);
+  e |= closeWritten(file, filename);
   if (S) svdFreeSMat(S);
+  return e;
+}
+
+
+/************************** Streaming Conversion *****************************/
+
+/* svdConvertMatrixFile copies a matrix from one file to another a line at a
+   time, where a line is a column of a sparse file or a row of a dense one,
+   so the whole matrix is never held.  If the lines of the input run the
+   other way from those of the output, the entries are instead sorted into
+   runs in a temporary file and merged back a line at a time, an external
+   transpose.  The sth, sbm, mm and sb2 layouts can't be read this way, nor
+   sth, sbm and sb2 written, so those are converted in memory, as are sets
+   of shards. */
+#define STREAM_IN(f)  ((f) == SVD_F_ST || (f) == SVD_F_SB || \
+                       (f) == SVD_F_DT || (f) == SVD_F_DB || \
+                       (f) == SVD_F_DB2 || (f) == SVD_F_NPY)
+#define STREAM_OUT(f) ((f) == SVD_F_ST || (f) == SVD_F_SB || (f) == SVD_F_MM || \
+                       (f) == SVD_F_DT || (f) == SVD_F_DB || \
+                       (f) == SVD_F_DB2 || (f) == SVD_F_NPY)
+
+/* Dense rows are written in blocks of about this many values. */
+#define BLOCK_VALUES (1 << 20)
+/* The most entries in each sorted run of an external transpose. */
+#define RUN_ENTRIES (1 << 20)
+/* The least number of entries read from a run at a time while merging. */
+#define MERGE_ENTRIES 1024
+
+struct lineIn {
+  FILE *file;
+  struct svd_scan *scan;
+  int format, valueBytes;
+  char sparse;
+  long rows, cols, vals, seen;
+  uint32_t *w;
+};
+
+struct lineOut {
+  FILE *file;
+  int format;
+  char sparse;
+  long rows, cols, line;
+  double *block;
+  long blockRows, held;
+  uint32_t *w;
+  char failed;                  /* Set if a block couldn't be written. */
+};
+
+struct entry {
+  long line, index;
+  double value;
+};
+
+struct run {
+  off_t next, end;
+  struct entry *buf;
+  long at, have;
+};
+
+static char lineInOpen(struct lineIn *L, char *filename, int format) {
+  int n[3], e = 0;
+  memset(L, 0, sizeof(struct lineIn));
+  L->format = format;
+  L->sparse = SVD_IS_SPARSE(format);
+  L->file = svd_fatalReadFile(filename);
+  switch (format) {
+  case SVD_F_ST:
+  case SVD_F_DT:
+    if (!(L->scan = svd_scanOpen(L->file))) return TRUE;
+    if (svd_scanLong(L->scan, &L->rows) || svd_scanLong(L->scan, &L->cols) ||
+        (L->sparse && svd_scanLong(L->scan, &L->vals))) return TRUE;
+    break;
+  case SVD_F_SB:
+  case SVD_F_DB:
+    e += svd_readBinInt(L->file, n);
+    e += svd_readBinInt(L->file, n + 1);
+    if (L->sparse) e += svd_readBinInt(L->file, n + 2);
+    if (e) return TRUE;
+    L->rows = n[0];
+    L->cols = n[1];
+    if (L->sparse) L->vals = n[2];
+    break;
+  case SVD_F_DB2:
+    if (b2ReadHeader(L->file, DB2_MAGIC, &L->rows, &L->cols, &L->vals,
+                     &L->valueBytes) || L->vals != L->rows * L->cols)
+      return TRUE;
+    break;
+  case SVD_F_NPY:
+    if (npyReadHeader(L->file, &L->rows, &L->cols, &L->valueBytes))
+      return TRUE;
+    break;
+  }
+  if (L->rows < 0 || L->cols < 0 || L->vals < 0) return TRUE;
+  if (format == SVD_F_SB &&
+      !(L->w = (uint32_t *) malloc(2 * SB_PAIRS * sizeof(uint32_t))))
+    return TRUE;
+  return FALSE;
+}
+
+/* Reads the next line: the n entries of a column into index and value, or
+   the whole of a row into value. */
+static char lineInRead(struct lineIn *L, long *n, long *index, double *value) {
+  long i, m, k;
+  int c;
+  switch (L->format) {
+  case SVD_F_ST:
+    if (svd_scanLong(L->scan, n) || *n < 0 || L->seen + *n > L->vals)
+      return TRUE;
+    for (i = 0; i < *n; i++)
+      if (svd_scanLong(L->scan, index + i) ||
+          svd_scanDouble(L->scan, value + i) ||
+          index[i] < 0 || index[i] >= L->rows) return TRUE;
+    break;
+  case SVD_F_SB:
+    if (svd_readBinInt(L->file, &c) || c < 0 || L->seen + c > L->vals)
+      return TRUE;
+    *n = c;
+    for (i = 0; i < *n; i += m) {
+      m = (*n - i < SB_PAIRS) ? *n - i : SB_PAIRS;
+      if (svd_readBinWords(L->file, L->w, 2 * m)) return TRUE;
+      for (k = 0; k < m; k++) {
+        index[i + k] = (int32_t) L->w[2 * k];
+        value[i + k] = ((float *) L->w)[2 * k + 1];
+        if (index[i + k] < 0 || index[i + k] >= L->rows) return TRUE;
+      }
+    }
+    break;
+  case SVD_F_DT:
+    *n = L->cols;
+    for (i = 0; i < *n; i++)
+      if (svd_scanDouble(L->scan, value + i)) return TRUE;
+    break;
+  case SVD_F_DB:
+    *n = L->cols;
+    if (svd_readBinFloats(L->file, value, *n)) return TRUE;
+    break;
+  case SVD_F_DB2:
+    *n = L->cols;
+    if (b2ReadValues(L->file, value, *n, L->valueBytes)) return TRUE;
+    break;
+  case SVD_F_NPY:
+    *n = L->cols;
+    if (npyReadValues(L->file, value, *n, L->valueBytes)) return TRUE;
+    break;
+  }
+  L->seen += *n;
+  return FALSE;
+}
+
+static void lineInClose(struct lineIn *L) {
+  if (L->scan) svd_scanClose(L->scan);
+  svd_closeFile(L->file);
+  SAFE_FREE(L->w);
+}
+
+static char lineOutOpen(struct lineOut *O, char *filename, int format,
+                        long rows, long cols, long vals) {
+  memset(O, 0, sizeof(struct lineOut));
+  O->format = format;
+  O->sparse = SVD_IS_SPARSE(format);
+  O->rows = rows;
+  O->cols = cols;
+  if (format == SVD_F_SB && (rows > INT_MAX || cols > INT_MAX ||
+                             vals > INT_MAX)) {
+    svd_error("svdConvertMatrixFile: matrix too large, use sb2");
+    return TRUE;
+  }
+  if (O->sparse) {
+    if (format == SVD_F_SB &&
+        !(O->w = (uint32_t *) malloc(2 * SB_PAIRS * sizeof(uint32_t))))
+      return TRUE;
+  } else {
+    O->blockRows = (cols > 0 && cols < BLOCK_VALUES) ? BLOCK_VALUES / cols : 1;
+    if (!(O->block = svd_doubleArray(O->blockRows * (cols ? cols : 1), TRUE,
+                                     "svdConvertMatrixFile: block")))
+      return TRUE;
+  }
+  if (!(O->file = svd_writeFile(filename, FALSE))) {
+    svd_error("svdConvertMatrixFile: failed to write file %s", filename);
+    return TRUE;
+  }
+  switch (format) {
+  case SVD_F_ST:
+    fprintf(O->file, "%ld %ld %ld\n", rows, cols, vals);
+    break;
+  case SVD_F_SB:
+    svd_writeBinInt(O->file, (int) rows);
+    svd_writeBinInt(O->file, (int) cols);
+    svd_writeBinInt(O->file, (int) vals);
+    break;
+  case SVD_F_MM:
+    fprintf(O->file, "%s matrix coordinate real general\n", MM_BANNER);
+    fprintf(O->file, "%ld %ld %ld\n", rows, cols, vals);
+    break;
+  case SVD_F_DT:
+    fprintf(O->file, "%ld %ld\n", rows, cols);
+    break;
+  case SVD_F_DB:
+    svd_writeBinInt(O->file, (int) rows);
+    svd_writeBinInt(O->file, (int) cols);
+    break;
+  case SVD_F_DB2:
+    b2WriteHeader(O->file, DB2_MAGIC, rows, cols, rows * cols);
+    break;
+  case SVD_F_NPY:
+    npyWriteHeader(O->file, rows, cols);
+    break;
+  }
+  return FALSE;
+}
+
+static void lineOutFlush(struct lineOut *O) {
+  long n = O->held * O->cols;
+  if (!n) return;
+  switch (O->format) {
+  case SVD_F_DT:
+    O->failed |= writeValues(O->file, O->block, n, O->cols);
+    break;
+  case SVD_F_DB:
+    O->failed |= svd_writeBinFloats(O->file, O->block, n);
+    break;
+  case SVD_F_DB2:
+    O->failed |= b2WriteValues(O->file, O->block, n);
+    break;
+  case SVD_F_NPY:
+    O->failed |= npyWriteValues(O->file, O->block, n);
+    break;
+  }
+  memset(O->block, 0, n * sizeof(double));
+  O->held = 0;
+}
+
+/* Writes the next line: a column of n entries, or a row given either as n
+   entries or, if index is NULL, in full. */
+static void lineOutWrite(struct lineOut *O, long n, const long *index,
+                         const double *value) {
+  char x[SVD_NUMBER_LEN];
+  double *row;
+  long i, k, m;
+  switch (O->format) {
+  case SVD_F_ST:
+    fprintf(O->file, "%ld\n", n);
+    for (i = 0; i < n; i++) {
+      svd_formatDouble(x, value[i], (int) SVDPrecision);
+      fprintf(O->file, "%ld %s\n", index[i], x);
+    }
+    break;
+  case SVD_F_SB:
+    svd_writeBinInt(O->file, (int) n);
+    for (i = 0; i < n; i += m) {
+      m = (n - i < SB_PAIRS) ? n - i : SB_PAIRS;
+      for (k = 0; k < m; k++) {
+        O->w[2 * k] = (uint32_t) index[i + k];
+        ((float *) O->w)[2 * k + 1] = (float) value[i + k];
+      }
+      svd_writeBinWords(O->file, O->w, 2 * m);
+    }
+    break;
+  case SVD_F_MM:
+    for (i = 0; i < n; i++) {
+      svd_formatDouble(x, value[i], (int) SVDPrecision);
+      fprintf(O->file, "%ld %ld %s\n", index[i] + 1, O->line + 1, x);
+    }
+    break;
+  default:
+    row = O->block + O->held * O->cols;
+    if (!index) memcpy(row, value, O->cols * sizeof(double));
+    else for (i = 0; i < n; i++) row[index[i]] = value[i];
+    if (++O->held == O->blockRows) lineOutFlush(O);
+  }
+  O->line++;
+}
+
+static char lineOutClose(struct lineOut *O) {
+  char e = FALSE;
+  if (O->file) {
+    if (!O->sparse) lineOutFlush(O);
+    e = O->failed || (ferror(O->file) != 0);
+    e |= svd_closeFile(O->file);
+  }
+  SAFE_FREE(O->block);
+  SAFE_FREE(O->w);
+  return e;
+}
+
+/* The runs of an external transpose, written in turn to a temporary file.
+   Every run but the last holds size entries. */
+struct runs {
+  FILE *tmp;
+  struct entry *E, *sorted;
+  long *start, lines, size, held, count, vals;
+};
+
+/* Sorts the held entries by output line, keeping the order of the entries 
+   of each line, which is that of their input lines, and writes them out. */
+static char writeRun(struct runs *U) {
+  long i;
+  memset(U->start, 0, (U->lines + 1) * sizeof(long));
+  for (i = 0; i < U->held; i++) U->start[U->E[i].line + 1]++;
+  for (i = 1; i <= U->lines; i++) U->start[i] += U->start[i - 1];
+  for (i = 0; i < U->held; i++) U->sorted[U->start[U->E[i].line]++] = U->E[i];
+  if (fwrite(U->sorted, sizeof(struct entry), U->held, U->tmp) != U->held) {
+    svd_error("svdConvertMatrixFile: failed to write a temporary file");
+    return TRUE;
+  }
+  U->vals += U->held;
+  U->count++;
+  U->held = 0;
+  return FALSE;
+}
+
+static char addEntry(struct runs *U, long line, long index, double value) {
+  U->E[U->held].line = line;
+  U->E[U->held].index = index;
+  U->E[U->held].value = value;
+  return (++U->held == U->size) ? writeRun(U) : FALSE;
+}
+
+static char runNext(struct run *R, FILE *tmp) {
+  if (R->at < R->have) return FALSE;
+  if (R->next == R->end) return TRUE;
+  R->have = R->end - R->next;
+  if (R->have > MERGE_ENTRIES) R->have = MERGE_ENTRIES;
+  R->at = 0;
+  if (fseeko(tmp, R->next * sizeof(struct entry), SEEK_SET) ||
+      fread(R->buf, sizeof(struct entry), R->have, tmp) != R->have) {
+    R->have = 0;
+    R->next = R->end;
+    return TRUE;
+  }
+  R->next += R->have;
+  return FALSE;
+}
+
+/* Entry i of input line l, at index[i] (or i, for a dense row, whose
+   zeros are dropped), becomes entry l of output line index[i], or, if the
+   lines already run the same way, entry index[i] of output line l.  The 
+   runs are merged by taking each output line from every run in turn. */
+static char convertTransposed(struct lineIn *L, char *filename, int format,
+                              long rows, long cols, char across) {
+  struct runs U;
+  struct run *R = NULL;
+  struct lineOut O;
+  long *index = NULL, inLines, outLength, l, i, n, k;
+  double *value = NULL;
+  char e = TRUE;
+
+  memset(&U, 0, sizeof(struct runs));
+  memset(&O, 0, sizeof(struct lineOut));
+  inLines = (L->sparse) ? L->cols : L->rows;
+  U.lines = (SVD_IS_SPARSE(format)) ? cols : rows;
+  outLength = (SVD_IS_SPARSE(format)) ? rows : cols;
+  index = svd_longArray(svd_imax(L->rows, outLength) + 1, FALSE,
+                        "svdConvertMatrixFile: index");
+  value = svd_doubleArray(svd_imax(svd_imax(L->rows, L->cols), outLength) + 1,
+                          FALSE, "svdConvertMatrixFile: value");
+  U.start = svd_longArray(U.lines + 1, FALSE, "svdConvertMatrixFile: start");
+  U.size = (L->sparse) ? L->vals : L->rows * L->cols;
+  if (U.size > RUN_ENTRIES) U.size = RUN_ENTRIES;
+  if (U.size < 1) U.size = 1;
+  U.E = (struct entry *) malloc(U.size * sizeof(struct entry));
+  U.sorted = (struct entry *) malloc(U.size * sizeof(struct entry));
+  if (!index || !value || !U.start || !U.E || !U.sorted) goto done;
+  if (!(U.tmp = tmpfile())) {
+    svd_error("svdConvertMatrixFile: failed to open a temporary file");
+    goto done;
+  }
+
+  for (l = 0; l < inLines; l++) {
+    if (lineInRead(L, &n, index, value)) {
+      svd_error("svdConvertMatrixFile: bad file format");
+      goto done;
+    }
+    for (i = 0; i < n; i++) {
+      k = (L->sparse) ? index[i] : i;
+      if (!L->sparse && value[i] == 0) continue;
+      if (addEntry(&U, (across) ? k : l, (across) ? l : k, value[i])) 
+        goto done;
+    }
+  }
+  if (U.held && writeRun(&U)) goto done;
+  SAFE_FREE(U.E);
+  SAFE_FREE(U.sorted);
+
+  if (!(R = (struct run *) calloc(U.count + 1, sizeof(struct run))))
+    goto done;
+  for (k = 0; k < U.count; k++) {
+    R[k].next = k * (off_t) U.size;
+    R[k].end = (k < U.count - 1) ? R[k].next + U.size : U.vals;
+    if (!(R[k].buf = (struct entry *)
+          malloc(MERGE_ENTRIES * sizeof(struct entry)))) goto done;
+  }
+  if (lineOutOpen(&O, filename, format, rows, cols, U.vals)) goto done;
+  for (l = 0; l < U.lines; l++) {
+    for (k = 0, n = 0; k < U.count; k++)
+      while (!runNext(R + k, U.tmp) && R[k].buf[R[k].at].line == l) {
+        index[n] = R[k].buf[R[k].at].index;
+        value[n++] = R[k].buf[R[k].at++].value;
+      }
+    lineOutWrite(&O, n, index, value);
+  }
+  e = FALSE;
+
+ done:
+  if (lineOutClose(&O)) e = TRUE;
+  for (k = 0; R && k < U.count; k++) SAFE_FREE(R[k].buf);
+  SAFE_FREE(R);
+  if (U.tmp) fclose(U.tmp);
+  SAFE_FREE(U.E);
+  SAFE_FREE(U.sorted);
+  SAFE_FREE(U.start);
+  SAFE_FREE(index);
+  SAFE_FREE(value);
+  return e;
+}
+
+static char convertInMemory(char *infile, int inFormat, char *outfile,
+                            int outFormat, char transpose) {
+  char e;
+  if (SVD_IS_SPARSE(inFormat) && SVD_IS_SPARSE(outFormat)) {
+    SMat S = (transpose) ? svdLoadTransposedSparseMatrix(infile, inFormat) :
+      svdLoadSparseMatrix(infile, inFormat);
+    if (!S) return TRUE;
+    e = svdWriteSparseMatrix(S, outfile, outFormat);
+    svdFreeSMat(S);
+  } else {
+    DMat D = svdLoadDenseMatrix(infile, inFormat);
+    if (!D) return TRUE;
+    if (transpose) {
+      DMat T = svdTransposeD(D);
+      svdFreeDMat(D);
+      if (!(D = T)) return TRUE;
+    }
+    e = svdWriteDenseMatrix(D, outfile, outFormat);
+    svdFreeDMat(D);
+  }
+  return e;
+}
+
+char svdConvertMatrixFile(char *infile, int inFormat, char *outfile,
+                          int outFormat, char transpose) {
+  struct lineIn L;
+  struct lineOut O;
+  long rows, cols, l, n, *index = NULL;
+  double *value = NULL;
+  char e = TRUE, inColumns, outColumns;
+  if (!STREAM_IN(inFormat) || !STREAM_OUT(outFormat) || isPattern(infile))
+    return convertInMemory(infile, inFormat, outfile, outFormat, transpose);
+
+  memset(&O, 0, sizeof(struct lineOut));
+  if (lineInOpen(&L, infile, inFormat)) {
+    svd_error("svdConvertMatrixFile: bad file format in %s", infile);
+    goto done;
+  }
+  rows = (transpose) ? L.cols : L.rows;
+  cols = (transpose) ? L.rows : L.cols;
+  /* Whether the input lines are columns of the output, and whether the
+     output wants columns.  A dense input gives no count of nonzeros for a
+     sparse header, so it takes the long way round. */
+  inColumns = (L.sparse != transpose);
+  outColumns = SVD_IS_SPARSE(outFormat);
+  if (inColumns != outColumns || (!L.sparse && outColumns)) {
+    e = convertTransposed(&L, outfile, outFormat, rows, cols, 
+                          inColumns != outColumns);
+    goto done;
+  }
+
+  index = svd_longArray(L.rows + 1, FALSE, "svdConvertMatrixFile: index");
+  value = svd_doubleArray(svd_imax(L.rows, L.cols) + 1, FALSE,
+                          "svdConvertMatrixFile: value");
+  if (!index || !value ||
+      lineOutOpen(&O, outfile, outFormat, rows, cols, L.vals)) goto done;
+  for (l = 0; l < ((L.sparse) ? L.cols : L.rows); l++) {
+    if (lineInRead(&L, &n, index, value)) {
+      svd_error("svdConvertMatrixFile: bad file format in %s", infile);
+      goto done;
+    }
+    lineOutWrite(&O, n, (L.sparse) ? index : NULL, value);
+  }
+  e = FALSE;
+
+ done:
+  if (lineOutClose(&O)) e = TRUE;
+  lineInClose(&L);
+  SAFE_FREE(index);
+  SAFE_FREE(value);
+  return e;
+}
+
+/* A file sink writes each row of Ut and Vt as soon as it gets it. */
+struct fileSink {
+  struct svdsink sink;
+  char *ut, *s, *vt;
+  int format;
+  FILE *uFile, *vFile;
+  long d, rows, cols;
+  double *S;
+};
+
+static void writeDenseHeader(FILE *file, int format, long rows, long cols) {
+  switch (format) {
+  case SVD_F_DT:
+    fprintf(file, "%ld %ld\n", rows, cols);
+    break;
+  case SVD_F_DB:
+    svd_writeBinInt(file, (int) rows);
+    svd_writeBinInt(file, (int) cols);
+    break;
+  case SVD_F_DB2:
+    b2WriteHeader(file, DB2_MAGIC, rows, cols, rows * cols);
+    break;
+  case SVD_F_NPY:
+    npyWriteHeader(file, rows, cols);
+    break;
+  }
+}
+
+/* Returns TRUE if the row couldn't be written. */
+static char writeDenseRow(FILE *file, int format, const double *a, long n) {
+  switch (format) {
+  case SVD_F_DT:
+    return writeValues(file, a, n, n);
+  case SVD_F_DB:
+    return svd_writeBinFloats(file, a, n);
+  case SVD_F_DB2:
+    return b2WriteValues(file, a, n);
+  case SVD_F_NPY:
+    return npyWriteValues(file, a, n);
+  }
+  return FALSE;
+}
+
+static int fileSinkBegin(SVDSink sink, long d, long rows, long cols) {
+  struct fileSink *F = (struct fileSink *) sink->data;
+  F->d = d;
+  F->rows = rows;
+  F->cols = cols;
+  SAFE_FREE(F->S);
+  if (!(F->S = svd_doubleArray(d, TRUE, "fileSinkBegin: S"))) return 1;
+  if (!(F->uFile = svd_writeFile(F->ut, FALSE))) {
+    svd_error("svdNewFileSink: failed to write file %s", F->ut);
+    return 1;
+  }
+  if (!(F->vFile = svd_writeFile(F->vt, FALSE))) {
+    svd_error("svdNewFileSink: failed to write file %s", F->vt);
+    return 1;
+  }
+  writeDenseHeader(F->uFile, F->format, d, rows);
+  writeDenseHeader(F->vFile, F->format, d, cols);
+  return 0;
+}
+
+static int fileSinkTriple(SVDSink sink, long i, double s, const double *u, 
+                          const double *v) {
+  struct fileSink *F = (struct fileSink *) sink->data;
+  int e;
+  F->S[i] = s;
+  e = writeDenseRow(F->uFile, F->format, u, F->rows);
+  e |= writeDenseRow(F->vFile, F->format, v, F->cols);
+  return e || ferror(F->uFile) || ferror(F->vFile);
+}
+
+static int closeSinkFile(FILE **file, char *filename) {
+  int e = 0;
+  if (*file) {
+    e = closeWritten(*file, filename);
+    *file = NULL;
+  }
+  return e;
+}
+
+static int fileSinkEnd(SVDSink sink) {
+  struct fileSink *F = (struct fileSink *) sink->data;
+  int e = closeSinkFile(&F->uFile, F->ut);
+  e |= closeSinkFile(&F->vFile, F->vt);
+  e |= svdWriteDenseArrayFormat(F->S, (int) F->d, F->s, 
+                                (F->format == SVD_F_NPY) ? SVD_F_NPY : 
+                                SVD_F_DT);
+  return e;
+}
+
+SVDSink svdNewFileSink(char *ut, char *s, char *vt, int format) {
+  struct fileSink *F;
+  if (format != SVD_F_DT && format != SVD_F_DB && format != SVD_F_DB2 &&
+      format != SVD_F_NPY) {
+    svd_error("svdNewFileSink: the vectors can only be streamed to a dense "
+              "format");
+    return NULL;
+  }
+  if (!(F = (struct fileSink *) calloc(1, sizeof(struct fileSink)))) {
+    perror("svdNewFileSink");
+    return NULL;
+  }
+  F->sink.begin = fileSinkBegin;
+  F->sink.triple = fileSinkTriple;
+  F->sink.end = fileSinkEnd;
+  F->sink.data = F;
+  F->ut = ut;
+  F->s = s;
+  F->vt = vt;
+  F->format = format;
+  return &F->sink;
+}
+
+void svdFreeFileSink(SVDSink sink) {
+  struct fileSink *F;
+  if (!sink) return;
+  F = (struct fileSink *) sink->data;
+  if (F->uFile) svd_closeFile(F->uFile);
+  if (F->vFile) svd_closeFile(F->vFile);
+  SAFE_FREE(F->S);
+  free(F);
 }
@@ -43,6 +43,7 @@ POSSIBILITY OF SUCH DAMAGE.
 typedef struct smat *SMat;
 typedef struct dmat *DMat;
 typedef struct svdrec *SVDRec;
+typedef struct svdworkspace *SVDWorkspace;
 
 /* Harwell-Boeing sparse matrix. */
 struct smat {
@@ -52,6 +53,8 @@ struct smat {
   long *pointr;  /* For each col (plus 1), index of first non-zero entry. */
   long *rowind;  /* For each nz entry, the row index. */
   double *value; /* For each nz entry, the value. */
+  void *map;     /* If the arrays are in a mapped file, the mapping. */
+  long mapSize;
 };
 
 /* Row-major dense matrix.  Rows are consecutive vectors. */
@@ -79,12 +82,100 @@ extern char *SVDVersion;
 /* How verbose is the package: 0, 1 (default), 2 */
 extern long SVDVerbosity;
 
-/* Counter(s) used to track how much work is done in computing the SVD. */
+/* How many threads the package may use: 0 (default) for one per processor */
+extern long SVDThreads;
+
+/* If set, svdLAS2 saves the state of its Lanczos run to this file every
+   SVDCheckpointInterval steps (default 100), and resumes from the file if 
+   it was left by an interrupted run on the same problem.  The file is 
+   removed when the run completes, but kept if the singular vectors could
+   not be formed or written. */
+extern char *SVDCheckpointFile;
+extern long SVDCheckpointInterval;
+
+/* If set, svdLAS2 calls SVDProgress every SVDProgressInterval Lanczos 
+   steps (default 100).  It is passed the step about to be taken, the 
+   number of Ritz values that have stabilized, and the count Ritz values 
+   of A'A (the squared singular values) computed so far, in increasing 
+   order, with their error bounds.  For svdLAS2Smallest these are Ritz 
+   values of the filtered operator instead.  elapsed is the wall clock time in 
+   seconds since svdLAS2 was called, and data is SVDProgressData.  If it
+   returns nonzero, the run is cancelled: svdLAS2 frees its work space and
+   returns NULL. */
+typedef int (*SVDProgressFunc)(long step, long converged, long count, 
+                               const double *ritz, const double *bounds, 
+                               double elapsed, void *data);
+extern SVDProgressFunc SVDProgress;
+extern void *SVDProgressData;
+extern long SVDProgressInterval;
+
+/* If SVDOutput is set, svdLAS2 and svdLAS2Smallest pass each singular 
+   triple to it as soon as the triple is computed, rather than keeping the 
+   vectors, so the full Ut and Vt are never held in memory.  The SVDRec
+   returned then has the singular values but NULL Ut and Vt.  begin (if
+   not NULL) is called first with the number of triples and the lengths of
+   the left and right vectors, then triple for each in turn, with the same
+   order and index as in the SVDRec, and then end (if not NULL).  u and v
+   are only valid during the call.  A nonzero return from any of them 
+   fails the run.  svdLAS2Smallest can't sort triples it has passed on, so
+   with SVDOutput they, and the values in the SVDRec, come in the order 
+   found, which is nearly, but not always exactly, increasing. */
+struct svdsink {
+  int (*begin)(struct svdsink *sink, long d, long rows, long cols);
+  int (*triple)(struct svdsink *sink, long i, double s, const double *u, 
+                const double *v);
+  int (*end)(struct svdsink *sink);
+  void *data;
+};
+typedef struct svdsink *SVDSink;
+extern SVDSink SVDOutput;
+
+/* If positive, svdLAS2 takes fewer Lanczos steps where needed to keep its 
+   peak memory use, as predicted by svdPlanLAS2, below this many bytes, and 
+   fails if it can't. */
+extern long SVDMemoryLimit;
+
+/* How svdLAS2 backs its work space: 0 (default) for ordinary memory, 1 
+   for transparent huge pages, or 2 for explicit (hugetlbfs) huge pages, 
+   falling back to transparent ones when none are free.  Huge pages cut the
+   TLB misses of sweeping over long Lanczos vectors. */
+extern long SVDHugePages;
+
+/* Where the matrix and the Lanczos vectors go on a machine with several 
+   NUMA nodes.  SVD_NUMA_NONE (default) leaves each page on the node of the
+   thread that first touches it, usually the one that loaded the matrix.  
+   SVD_NUMA_INTERLEAVE spreads the pages of each array over all the nodes.
+   SVD_NUMA_PARTITION keeps each pool thread on one node and puts the 
+   strip of the matrix that thread multiplies by, and the matching parts of
+   the vectors, on that node. */
+enum svdNumaPolicies {SVD_NUMA_NONE, SVD_NUMA_INTERLEAVE, SVD_NUMA_PARTITION};
+extern long SVDNumaPolicy;
+
+/* Significant digits, up to 17, of the values in text files written.  The
+   default of 6 matches %g.  0 writes the fewest digits that read back as 
+   exactly the same double. */
+extern long SVDPrecision;
+
+/* If true, values in sb2, db2 and npy files are written as 4-byte floats 
+   rather than 8-byte doubles. */
+extern long SVDBinaryFloat;
+
+/* If set, svdLoadSparseMatrix keeps a memory-mapped binary copy of each 
+   text matrix file it parses in this directory, and uses it in place of 
+   the text until the file changes.  If SVDCacheLimit is positive, the 
+   least recently used copies are removed to keep the directory below that
+   many bytes. */
+extern char *SVDCacheDir;
+extern long SVDCacheLimit;
+
+/* Counter(s) used to track how much work is done in computing the SVD.
+   These are kept separately for each thread. */
 enum svdCounters {SVD_MXV, SVD_COUNTERS};
-extern long SVDCount[SVD_COUNTERS];
+extern __thread long SVDCount[SVD_COUNTERS];
 extern void svdResetCounters(void);
 
-enum svdFileFormats {SVD_F_STH, SVD_F_ST, SVD_F_SB, SVD_F_DT, SVD_F_DB};
+enum svdFileFormats {SVD_F_STH, SVD_F_ST, SVD_F_SB, SVD_F_DT, SVD_F_DB, 
+                     SVD_F_SBM, SVD_F_MM, SVD_F_SB2, SVD_F_DB2, SVD_F_NPY};
 /*
 File formats:
 SVD_F_STH: sparse text, SVDPACK-style
@@ -92,10 +183,17 @@ SVD_F_ST:  sparse text, SVDLIB-style
 SVD_F_DT:  dense text
 SVD_F_SB:  sparse binary
 SVD_F_DB:  dense binary
+SVD_F_SBM: sparse binary in native layout, mapped into memory when read
+SVD_F_MM:  Matrix Market coordinate text
+SVD_F_SB2: sparse binary with 8-byte counts and double (or float) values
+SVD_F_DB2: dense binary with 8-byte counts and double (or float) values
+SVD_F_NPY: dense NumPy .npy array of little-endian doubles (or floats)
 */
 
 /* True if a file format is sparse: */
-#define SVD_IS_SPARSE(format) ((format >= SVD_F_STH) && (format <= SVD_F_SB))
+#define SVD_IS_SPARSE(format) ((format) == SVD_F_STH || (format) == SVD_F_ST || \
+                               (format) == SVD_F_SB || (format) == SVD_F_SBM || \
+                               (format) == SVD_F_MM || (format) == SVD_F_SB2)
 
 
 /******************************** Functions **********************************/
@@ -106,7 +204,7 @@ extern DMat svdNewDMat(int rows, int cols);
 extern void svdFreeDMat(DMat D);
 
 /* Creates an empty sparse matrix. */
-SMat svdNewSMat(int rows, int cols, int vals);
+SMat svdNewSMat(long rows, long cols, long vals);
 /* Frees a sparse matrix. */
 void svdFreeSMat(SMat S);
 
@@ -124,21 +222,61 @@ SMat svdConvertDtoS(DMat D);
 DMat svdTransposeD(DMat D);
 /* Transposes a sparse matrix (returning a new one) */
 SMat svdTransposeS(SMat S);
+/* Transposes a sparse matrix within its own arrays, for when the original
+   is no longer needed.  Returns the transpose, which is S itself unless S 
+   is mapped from a file, in which case S is freed; S must not be used after.
+   Returns NULL, leaving S as it was, if short of memory. */
+SMat svdTransposeSInPlace(SMat S);
 
-/* Writes an array to a file. */
-extern void svdWriteDenseArray(double *a, int n, char *filename, char binary);
+/* Writes an array to a file.  Returns TRUE on failure. */
+extern char svdWriteDenseArray(double *a, int n, char *filename, char binary);
+/* Writes an array to a file as a 1-D .npy array if format is SVD_F_NPY, in
+   binary if it is SVD_F_DB, and as text otherwise.  Returns TRUE on 
+   failure. */
+extern char svdWriteDenseArrayFormat(double *a, int n, char *filename, 
+                                     int format);
 /* Reads an array from a file, storing its size in *np. */
 extern double *svdLoadDenseArray(char *filename, int *np, char binary);
 
-/* Loads a matrix file (in various formats) into a sparse matrix. */
+/* Reads the size of the matrix in a file without loading it.  For the 
+   dense formats, vals is rows * cols, and for symmetric Matrix Market 
+   files, it is twice the number of entries stored.  For a glob pattern, it
+   is the size of the matched files side by side.  Returns 0 on success. */
+extern int svdLoadMatrixSize(char *filename, int format, long *rows, 
+                             long *cols, long *vals);
+/* Loads a matrix file (in various formats) into a sparse matrix.  A file 
+   name with wildcards that names no file is taken as a glob pattern, and 
+   the files it matches are loaded as by svdLoadSparseMatrices. */
 extern SMat svdLoadSparseMatrix(char *filename, int format);
-/* Loads a matrix file (in various formats) into a dense matrix. */
+/* Loads several matrix files with the same number of rows on the thread 
+   pool and lays them side by side, the columns of each following those of
+   the one before. */
+extern SMat svdLoadSparseMatrices(char **filenames, int count, int format);
+/* Loads the transpose of a matrix file into a sparse matrix.  ST and SB 
+   files are read twice, so that only the transpose is ever in memory. */
+extern SMat svdLoadTransposedSparseMatrix(char *filename, int format);
+/* Converts a matrix file to another format, transposing it if asked, 
+   without holding the whole matrix where the formats allow.  Returns TRUE
+   on failure. */
+extern char svdConvertMatrixFile(char *infile, int inFormat, char *outfile,
+                                 int outFormat, char transpose);
+/* Loads a matrix file (in various formats) into a dense matrix, taking a 
+   glob pattern as svdLoadSparseMatrix does. */
 extern DMat svdLoadDenseMatrix(char *filename, int format);
 
-/* Writes a dense matrix to a file in a given format. */
-extern void svdWriteDenseMatrix(DMat A, char *filename, int format);
-/* Writes a sparse matrix to a file in a given format. */
-extern void svdWriteSparseMatrix(SMat A, char *filename, int format);
+/* Writes a dense matrix to a file in a given format.  Returns TRUE on 
+   failure. */
+extern char svdWriteDenseMatrix(DMat A, char *filename, int format);
+/* Writes a sparse matrix to a file in a given format.  Returns TRUE on 
+   failure. */
+extern char svdWriteSparseMatrix(SMat A, char *filename, int format);
+
+/* Creates a sink for SVDOutput that writes Ut and Vt, row by row, to the 
+   files ut and vt as dense matrices in a dense format, and S to the file s
+   as svdWriteDenseArray would.  Returns NULL if the format isn't dense. */
+extern SVDSink svdNewFileSink(char *ut, char *s, char *vt, int format);
+/* Frees a sink made by svdNewFileSink, closing any files left open. */
+extern void svdFreeFileSink(SVDSink sink);
 
 
 /* Performs the las2 SVD algorithm and returns the resulting Ut, S, and Vt. */
@@ -147,4 +285,63 @@ extern SVDRec svdLAS2(SMat A, long dimensions, long iterations, double end[2],
 /* Chooses default parameter values.  Set dimensions to 0 for all dimensions: */
 extern SVDRec svdLAS2A(SMat A, long dimensions);
 
+/* Finds the smallest singular triples of A, in increasing order (nearly
+   so with SVDOutput, which see).  The 
+   Lanczos run is made on a Chebyshev polynomial in A'A of the given degree
+   (20 if degree <= 0), which maps the small eigenvalues of A'A to large, 
+   well separated ones.  Each Lanczos step then costs degree 
+   multiplications by A'A, but far fewer steps are needed than to resolve
+   the bottom of the spectrum of A'A directly.  The filter treats the 
+   eigenvalues of A'A above their mean as unwanted, so dimensions should be
+   well below half of min(rows, cols).  iterations limits the number of 
+   Lanczos steps as for svdLAS2.  Like svdLAS2, it cannot resolve singular
+   values much below sqrt(eps) times the largest; svdGKL can. */
+extern SVDRec svdLAS2Smallest(SMat A, long dimensions, long iterations, 
+                              long degree, double kappa);
+
+/* Memory svdLAS2 needs, in bytes. */
+struct svdplan {
+  long rows, cols, vals;        /* Size of A. */
+  long dimensions, iterations;  /* As svdLAS2 would use them. */
+  char transposed;              /* The run is made on AA' rather than A'A. */
+  long matrix;                  /* A itself. */
+  long basis;                   /* The Lanczos vectors. */
+  long lanczos;                 /* Other work space of the Lanczos run. */
+  long vectors;                 /* Work space while forming the vectors. */
+  long result;                  /* Ut, S and Vt, or S with SVDOutput. */
+  long peak;                    /* Most in use at once, including A. */
+};
+
+/* Fills in the memory plan for svdLAS2 on a matrix of the given size, or 
+   for svdLAS2Smallest if degree is nonzero.  If budget is positive and the
+   peak would exceed it, iterations is lowered to fit, though not below 
+   dimensions.  Returns 0 if the plan fits the budget, 1 if it can't. */
+extern int svdPlanLAS2(struct svdplan *P, long rows, long cols, long vals, 
+                       long dimensions, long iterations, long degree, 
+                       long budget);
+
+/* svdLAS2 carves all of its work space, Lanczos vectors included, from 
+   one block sized at the start of the run.  Normally that block is freed 
+   when the run ends; a workspace passed to svdUseWorkspace instead holds 
+   it for later runs on the same thread, growing only when a larger 
+   problem needs it, so that a series of runs allocates once. */
+extern SVDWorkspace svdNewWorkspace(void);
+/* Frees a workspace and its block. */
+extern void svdFreeWorkspace(SVDWorkspace W);
+/* Has later svdLAS2 calls on the calling thread use W, or work space of 
+   their own if W is NULL.  Returns the workspace that was in use. */
+extern SVDWorkspace svdUseWorkspace(SVDWorkspace W);
+
+/* Performs Golub-Kahan-Lanczos bidiagonalization of A itself (rather than
+   A'A) and returns the resulting Ut, S, and Vt. */
+extern SVDRec svdGKL(SMat A, long dimensions, long iterations, double kappa);
+
+/* Computes the SVDs of count independent matrices on SVDThreads threads,
+   using the las2 parameters for each.  Small matrices are decomposed by a 
+   dense method instead.  Returns a new array of count SVDRecs, with NULL
+   entries for any that failed.  Free each with svdFreeSVDRec, then the
+   array itself with free. */
+extern SVDRec *svdLAS2Batch(SMat *mats, int count, long dimensions, 
+                            long iterations, double end[2], double kappa);
+
 #endif /* SVDLIB_H */
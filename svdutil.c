@@ -29,24 +29,40 @@ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 POSSIBILITY OF SUCH DAMAGE.
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <math.h>
+#include <limits.h>
+#include <float.h>
+#include <zlib.h>
+#include <bzlib.h>
+#ifdef SVD_ZSTD
+#include <zstd.h>
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
 
 #include "svdlib.h"
 #include "svdutil.h"
 
-#define BUNZIP2  "bzip2 -d"
-#define BZIP2    "bzip2 -1"
 #define UNZIP    "gzip -d"
-#define ZIP      "gzip -1"
 #define COMPRESS "compress"
+#define UNZSTD   "zstd -d -q"
+#define ZSTD     "zstd -1 -q"
 
 #define MAX_FILENAME 512
 #define MAX_PIPES    64
@@ -75,6 +91,78 @@ double *svd_doubleArray(long size, char empty, char *name) {
   return a;
 }
 
+/******************************** Workspace **********************************/
+
+/* Huge pages are taken to be 2 MB, the usual size on x86-64 and ARM64. */
+#define HUGE_PAGE (2L << 20)
+
+void svd_release(SVDWorkspace W) {
+  if (W->map) munmap(W->map, W->mapSize);
+  else SAFE_FREE(W->base);
+  W->base = W->map = NULL;
+  W->size = W->mapSize = W->used = 0;
+}
+
+/* With SVDHugePages, the block is mapped on its own so that it can be 
+   backed by huge pages: explicit ones with MAP_HUGETLB if asked for and 
+   any are free, otherwise ordinary pages with a MADV_HUGEPAGE hint, 
+   mapped a huge page larger than needed so that the block can start on a
+   huge page boundary. */
+char svd_reserve(SVDWorkspace W, long bytes) {
+  void *p = MAP_FAILED;
+  long size;
+  W->used = 0;
+  if (bytes <= W->size) return FALSE;
+  svd_release(W);
+  if (SVDHugePages) {
+    size = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+#ifdef MAP_HUGETLB
+    if (SVDHugePages > 1) {
+      p = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (p != MAP_FAILED) {
+        W->map = W->base = (char *) p;
+        W->mapSize = W->size = size;
+        return FALSE;
+      }
+    }
+#endif
+    p = mmap(NULL, size + HUGE_PAGE, PROT_READ | PROT_WRITE, 
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) {
+      W->map = p;
+      W->mapSize = size + HUGE_PAGE;
+      W->base = (char *) (((unsigned long) p + HUGE_PAGE - 1) & 
+                          ~(unsigned long) (HUGE_PAGE - 1));
+      W->size = size;
+#ifdef MADV_HUGEPAGE
+      madvise(W->base, size, MADV_HUGEPAGE);
+#endif
+      return FALSE;
+    }
+  }
+  if (posix_memalign(&p, SVD_ALIGN, bytes)) {
+    perror("svd_reserve");
+    return TRUE;
+  }
+  W->base = (char *) p;
+  W->size = bytes;
+  return FALSE;
+}
+
+double *svd_carve(SVDWorkspace W, long size, char empty, char *name) {
+  long bytes = SVD_ALIGNED(size * sizeof(double));
+  double *a;
+  if (W->used + bytes > W->size) {
+    svd_error("%s: workspace exhausted", name);
+    return NULL;
+  }
+  a = (double *) (W->base + W->used);
+  W->used += bytes;
+  if (empty) memset(a, 0, size * sizeof(double));
+  return a;
+}
+
 void svd_beep(void) {
   fputc('\a', stderr);
   fflush(stderr);
@@ -108,6 +196,258 @@ void svd_fatalError(const char *fmt, ...) {
   exit(1);
 }
 
+/********************************* Threads ***********************************/
+
+/* The pool runs one job at a time; its workers sleep between jobs.  Each 
+   thread taking part claims the next unclaimed task until none are left, so
+   uneven tasks balance themselves.  In a fixed job, thread t instead runs 
+   tasks t, t + threads, and so on, so that each task always runs on the 
+   same thread, and so on the same NUMA node. */
+struct job {
+  void (*task)(long, int, void *);
+  void *arg;
+  long tasks;
+  long next;       /* Next task to hand out. */
+  int running;     /* Workers still busy with this job. */
+  int threads;     /* Threads taking part. */
+  char fixed;
+};
+
+static pthread_mutex_t JobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t PoolMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t PoolWake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t PoolDone = PTHREAD_COND_INITIALIZER;
+static struct job *PoolJob = NULL;
+static long PoolGeneration = 0;
+static int PoolThreads = 0;  /* Threads taking part in the current job. */
+static int PoolWorkers = 0;
+static __thread char InParallel = FALSE;
+
+int svd_threads(void) {
+  long n = SVDThreads;
+  if (n <= 0) n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n < 1) ? 1 : (int) n;
+}
+
+static void runJob(struct job *J, int thread) {
+  long i;
+  if (J->fixed)
+    for (i = thread; i < J->tasks; i += J->threads) J->task(i, thread, J->arg);
+  else while ((i = __sync_fetch_and_add(&J->next, 1)) < J->tasks)
+    J->task(i, thread, J->arg);
+}
+
+static void pinThread(int thread);
+
+static void *poolWorker(void *index) {
+  int thread = (int) (long) index;
+  long seen = 0;
+  struct job *J;
+  InParallel = TRUE;
+  pthread_mutex_lock(&PoolMutex);
+  for (;;) {
+    while (PoolGeneration == seen) pthread_cond_wait(&PoolWake, &PoolMutex);
+    seen = PoolGeneration;
+    if (thread >= PoolThreads) continue;
+    J = PoolJob;
+    pthread_mutex_unlock(&PoolMutex);
+    pinThread(thread);
+    runJob(J, thread);
+    pthread_mutex_lock(&PoolMutex);
+    if (--J->running == 0) pthread_cond_signal(&PoolDone);
+  }
+  return NULL;
+}
+
+static void parallel(long tasks, void (*task)(long i, int thread, void *arg),
+                     void *arg, char fixed) {
+  struct job J;
+  pthread_t t;
+  long i;
+  int threads = svd_threads();
+  if (threads > tasks) threads = (int) tasks;
+  if (threads <= 1 || InParallel || pthread_mutex_trylock(&JobLock)) {
+    for (i = 0; i < tasks; i++) task(i, 0, arg);
+    return;
+  }
+  pthread_mutex_lock(&PoolMutex);
+  while (PoolWorkers < threads - 1 && 
+         !pthread_create(&t, NULL, poolWorker, (void *) (long) (PoolWorkers + 1))) {
+    pthread_detach(t);
+    PoolWorkers++;
+  }
+  if (threads > PoolWorkers + 1) threads = PoolWorkers + 1;
+  J.task = task;
+  J.arg = arg;
+  J.tasks = tasks;
+  J.next = 0;
+  J.running = threads - 1;
+  J.threads = threads;
+  J.fixed = fixed;
+  PoolJob = &J;
+  PoolThreads = threads;
+  PoolGeneration++;
+  pthread_cond_broadcast(&PoolWake);
+  pthread_mutex_unlock(&PoolMutex);
+
+  InParallel = TRUE;
+  runJob(&J, 0);
+  InParallel = FALSE;
+
+  pthread_mutex_lock(&PoolMutex);
+  while (J.running) pthread_cond_wait(&PoolDone, &PoolMutex);
+  pthread_mutex_unlock(&PoolMutex);
+  pthread_mutex_unlock(&JobLock);
+}
+
+void svd_parallel(long tasks, void (*task)(long i, int thread, void *arg),
+                  void *arg) {
+  parallel(tasks, task, arg, FALSE);
+}
+
+void svd_parallelFixed(long tasks, void (*task)(long i, int thread, void *arg),
+                       void *arg) {
+  parallel(tasks, task, arg, TRUE);
+}
+
+/*********************************** NUMA ************************************/
+
+/* The nodes are read from sysfs once.  Under SVD_NUMA_PARTITION, the pool 
+   threads are spread over them in order, thread t going to node 
+   svd_threadNode(t), and each worker keeps to the CPUs of its node.  The 
+   calling thread, thread 0, is left where it is, on the assumption that it
+   is on the first node.  Pages are placed with mbind(), which moves any 
+   that are already in use; all of this is advice, and failures are 
+   ignored. */
+
+#define MAX_NODES 64
+static int NumaNodes = 1;
+static int NumaNode[MAX_NODES];
+static pthread_once_t numaOnce = PTHREAD_ONCE_INIT;
+static __thread int PinnedNode = -1;
+static __thread cpu_set_t Unpinned;
+
+/* Reads a sysfs list such as "0-3,8" into a set of flags. */
+static int readList(const char *fileName, char *set, int size) {
+  FILE *file = fopen(fileName, "r");
+  int a, b, n = 0;
+  if (!file) return 0;
+  memset(set, 0, size);
+  while (fscanf(file, "%d", &a) == 1) {
+    b = a;
+    if (fscanf(file, "-%d", &b) != 1) b = a;
+    for (; a <= b && a < size; a++)
+      if (a >= 0 && !set[a]) {
+        set[a] = TRUE;
+        n++;
+      }
+    if (fgetc(file) != ',') break;
+  }
+  fclose(file);
+  return n;
+}
+
+static void numaInit(void) {
+  char set[MAX_NODES];
+  int i;
+  if (readList("/sys/devices/system/node/has_memory", set, MAX_NODES) > 1) {
+    for (NumaNodes = 0, i = 0; i < MAX_NODES; i++)
+      if (set[i]) NumaNode[NumaNodes++] = i;
+  }
+}
+
+int svd_numaNodes(void) {
+  pthread_once(&numaOnce, numaInit);
+  return NumaNodes;
+}
+
+int svd_threadNode(int thread) {
+  return (int) ((long) thread * svd_numaNodes() / svd_threads());
+}
+
+static void pinThread(int thread) {
+  int node = -1, cpu;
+  char cpus[CPU_SETSIZE], name[64];
+  cpu_set_t set;
+  if (SVDNumaPolicy == SVD_NUMA_PARTITION && svd_numaNodes() > 1)
+    node = svd_threadNode(thread);
+  if (node == PinnedNode) return;
+  if (PinnedNode < 0) sched_getaffinity(0, sizeof(cpu_set_t), &Unpinned);
+  if (node < 0) sched_setaffinity(0, sizeof(cpu_set_t), &Unpinned);
+  else {
+    sprintf(name, "/sys/devices/system/node/node%d/cpulist", NumaNode[node]);
+    if (!readList(name, cpus, CPU_SETSIZE)) return;
+    CPU_ZERO(&set);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) if (cpus[cpu]) CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(cpu_set_t), &set);
+  }
+  PinnedNode = node;
+}
+
+void svd_numaPlace(void *p, long bytes, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  unsigned long mask[MAX_NODES / (8 * sizeof(long))], page, start, end;
+  int i, mode = MPOL_INTERLEAVE;
+  if (svd_numaNodes() < 2 || bytes <= 0) return;
+  page = sysconf(_SC_PAGESIZE);
+  start = ((unsigned long) p + page - 1) & ~(page - 1);
+  end = ((unsigned long) p + bytes) & ~(page - 1);
+  if (end <= start) return;
+  memset(mask, 0, sizeof(mask));
+  if (node >= 0) {
+    mode = MPOL_PREFERRED;
+    i = NumaNode[node % NumaNodes];
+    mask[i / (8 * sizeof(long))] |= 1UL << (i % (8 * sizeof(long)));
+  } else for (node = 0; node < NumaNodes; node++) {
+    i = NumaNode[node];
+    mask[i / (8 * sizeof(long))] |= 1UL << (i % (8 * sizeof(long)));
+  }
+  syscall(SYS_mbind, start, end - start, mode, mask, MAX_NODES + 1, 
+          MPOL_MF_MOVE);
+#endif
+}
+
+void svd_numaSpread(void *p, long width, const long *bound, int parts) {
+  int k;
+  if (SVDNumaPolicy == SVD_NUMA_INTERLEAVE)
+    svd_numaPlace(p, (bound[parts] - bound[0]) * width, -1);
+  else if (SVDNumaPolicy == SVD_NUMA_PARTITION)
+    for (k = 0; k < parts; k++)
+      svd_numaPlace((char *) p + (bound[k] - bound[0]) * width, 
+                    (bound[k+1] - bound[k]) * width, svd_threadNode(k));
+}
+
+int svd_columnStrips(SMat A, long *col) {
+  int parts = svd_imin(svd_threads(), MAX_STRIPS), k;
+  long lo, hi, mid, want;
+  col[0] = 0;
+  for (k = 1; k < parts; k++) {
+    /* The first column at or after the k-th share of the entries */
+    want = A->vals / parts * k + A->vals % parts * k / parts;
+    lo = col[k-1];
+    hi = A->cols;
+    while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (A->pointr[mid] < want) lo = mid + 1;
+      else hi = mid;
+    }
+    col[k] = lo;
+  }
+  col[parts] = A->cols;
+  return parts;
+}
+
+void svd_numaPlaceMatrix(SMat A) {
+  long col[MAX_STRIPS + 1], entry[MAX_STRIPS + 1];
+  int parts, k;
+  if (!SVDNumaPolicy || svd_numaNodes() < 2) return;
+  parts = svd_columnStrips(A, col);
+  for (k = 0; k <= parts; k++) entry[k] = A->pointr[col[k]];
+  svd_numaSpread(A->pointr, sizeof(long), col, parts);
+  svd_numaSpread(A->rowind, sizeof(long), entry, parts);
+  svd_numaSpread(A->value, sizeof(double), entry, parts);
+}
+
 static void registerPipe(FILE *p) {
   if (numPipes >= MAX_PIPES) svd_error("Too many pipes open");
   Pipe[numPipes++] = p;
@@ -121,13 +461,282 @@ static char isPipe(FILE *p) {
   return TRUE;
 }
 
+/* A command that can't be run still gives a pipe, which reads as empty, so
+   a pipe read from is checked for output before it is handed back.  One 
+   that ends with no output and a failure status, such as zstd missing 
+   from the PATH, is an error rather than an empty file. */
 static FILE *openPipe(const char *pipeName, const char *mode) {
   FILE *pipe;
+  int c, status;
   fflush(stdout);
-  if ((pipe = popen(pipeName, mode))) registerPipe(pipe);
+  if (!(pipe = popen(pipeName, mode))) return NULL;
+  if (mode[0] == 'r') {
+    if ((c = getc(pipe)) == EOF) {
+      status = pclose(pipe);
+      if (status) {
+        svd_error("%s failed", pipeName);
+        return NULL;
+      }
+      return fopen("/dev/null", "r");
+    }
+    ungetc(c, pipe);
+  }
+  registerPipe(pipe);
   return pipe;
 }
 
+/* Compressed files are read and written in the library through a stdio
+   stream whose reads and writes go through zlib, libbz2 or, if compiled 
+   with SVD_ZSTD (which the Makefile sets whenever libzstd is installed), 
+   libzstd.  Only .Z files, and .zst files without libzstd, are still piped
+   through an external program. */
+
+enum zTypes {Z_GZIP, Z_BZIP2, Z_ZSTD};
+#define Z_BUFFER (1 << 17)
+
+struct zfile {
+  FILE *file;
+  int type;
+  char writing, failed;
+  char partial;       /* Input ended in the middle of a stream. */
+  gzFile gz;
+  bz_stream bz;
+#ifdef SVD_ZSTD
+  ZSTD_DCtx *zd;
+  ZSTD_CCtx *zc;
+  ZSTD_inBuffer in;
+#endif
+  char *buf;          /* Compressed data read or to be written. */
+  size_t len, pos;
+};
+
+/* Moves more of the compressed file into the buffer.  Returns the number of
+   bytes now waiting there. */
+static size_t zFill(struct zfile *z) {
+  if (z->pos < z->len) return z->len - z->pos;
+  z->pos = 0;
+  z->len = fread(z->buf, 1, Z_BUFFER, z->file);
+  return z->len;
+}
+
+static char zFlush(struct zfile *z, size_t len) {
+  if (len && fwrite(z->buf, 1, len, z->file) != len) z->failed = TRUE;
+  return z->failed;
+}
+
+static ssize_t bzRead(struct zfile *z, char *data, size_t size) {
+  int e;
+  z->bz.next_out = data;
+  z->bz.avail_out = size;
+  while (z->bz.avail_out) {
+    if (!z->bz.avail_in) {
+      if (!zFill(z)) {
+        if (z->partial) return -1;
+        break;
+      }
+      z->bz.next_in = z->buf;
+      z->bz.avail_in = z->len;
+      z->pos = z->len;
+    }
+    e = BZ2_bzDecompress(&z->bz);
+    z->partial = TRUE;
+    if (e == BZ_STREAM_END) {
+      /* Files written by parallel compressors hold several streams. */
+      char *next = z->bz.next_in;
+      unsigned int avail = z->bz.avail_in;
+      BZ2_bzDecompressEnd(&z->bz);
+      if (BZ2_bzDecompressInit(&z->bz, 0, 0) != BZ_OK) return -1;
+      z->bz.next_in = next;
+      z->bz.avail_in = avail;
+      z->bz.next_out = data + size - z->bz.avail_out;
+      z->partial = FALSE;
+    } else if (e != BZ_OK) return -1;
+  }
+  return size - z->bz.avail_out;
+}
+
+static ssize_t bzWrite(struct zfile *z, const char *data, size_t size) {
+  z->bz.next_in = (char *) data;
+  z->bz.avail_in = size;
+  while (z->bz.avail_in) {
+    z->bz.next_out = z->buf;
+    z->bz.avail_out = Z_BUFFER;
+    if (BZ2_bzCompress(&z->bz, BZ_RUN) != BZ_RUN_OK ||
+        zFlush(z, Z_BUFFER - z->bz.avail_out)) return -1;
+  }
+  return size;
+}
+
+static void bzFinish(struct zfile *z) {
+  int e;
+  do {
+    z->bz.next_out = z->buf;
+    z->bz.avail_out = Z_BUFFER;
+    e = BZ2_bzCompress(&z->bz, BZ_FINISH);
+    if (e != BZ_FINISH_OK && e != BZ_STREAM_END) z->failed = TRUE;
+    else zFlush(z, Z_BUFFER - z->bz.avail_out);
+  } while (e == BZ_FINISH_OK && !z->failed);
+}
+
+#ifdef SVD_ZSTD
+static ssize_t zstdRead(struct zfile *z, char *data, size_t size) {
+  ZSTD_outBuffer out = {data, size, 0};
+  size_t e;
+  while (out.pos < size) {
+    if (z->in.pos == z->in.size) {
+      if (!zFill(z)) {
+        if (z->partial) return -1;
+        break;
+      }
+      z->in.src = z->buf;
+      z->in.size = z->len;
+      z->in.pos = 0;
+      z->pos = z->len;
+    }
+    e = ZSTD_decompressStream(z->zd, &out, &z->in);
+    if (ZSTD_isError(e)) return -1;
+    z->partial = (e != 0);
+  }
+  return out.pos;
+}
+
+static ssize_t zstdWrite(struct zfile *z, const char *data, size_t size) {
+  ZSTD_inBuffer in = {data, size, 0};
+  ZSTD_outBuffer out;
+  size_t e;
+  while (in.pos < size) {
+    out.dst = z->buf;
+    out.size = Z_BUFFER;
+    out.pos = 0;
+    e = ZSTD_compressStream2(z->zc, &out, &in, ZSTD_e_continue);
+    if (ZSTD_isError(e) || zFlush(z, out.pos)) return -1;
+  }
+  return size;
+}
+
+static void zstdFinish(struct zfile *z) {
+  ZSTD_inBuffer in = {NULL, 0, 0};
+  ZSTD_outBuffer out;
+  size_t left;
+  do {
+    out.dst = z->buf;
+    out.size = Z_BUFFER;
+    out.pos = 0;
+    left = ZSTD_compressStream2(z->zc, &out, &in, ZSTD_e_end);
+    if (ZSTD_isError(left) || zFlush(z, out.pos)) z->failed = TRUE;
+  } while (left && !z->failed);
+}
+#endif /* SVD_ZSTD */
+
+static ssize_t zRead(void *cookie, char *data, size_t size) {
+  struct zfile *z = (struct zfile *) cookie;
+  int n;
+  switch (z->type) {
+  case Z_GZIP:
+    if (size > INT_MAX) size = INT_MAX;
+    return ((n = gzread(z->gz, data, (unsigned) size)) < 0) ? -1 : n;
+  case Z_BZIP2: return bzRead(z, data, size);
+#ifdef SVD_ZSTD
+  case Z_ZSTD: return zstdRead(z, data, size);
+#endif
+  }
+  return -1;
+}
+
+static ssize_t zWrite(void *cookie, const char *data, size_t size) {
+  struct zfile *z = (struct zfile *) cookie;
+  switch (z->type) {
+  case Z_GZIP:
+    if (size > INT_MAX) size = INT_MAX;
+    return (gzwrite(z->gz, data, (unsigned) size) > 0) ? (ssize_t) size : -1;
+  case Z_BZIP2: return bzWrite(z, data, size);
+#ifdef SVD_ZSTD
+  case Z_ZSTD: return zstdWrite(z, data, size);
+#endif
+  }
+  return -1;
+}
+
+static int zClose(void *cookie) {
+  struct zfile *z = (struct zfile *) cookie;
+  int failed;
+  switch (z->type) {
+  case Z_GZIP:
+    if (gzclose(z->gz) != Z_OK) z->failed = TRUE;
+    break;
+  case Z_BZIP2:
+    if (z->writing) {
+      bzFinish(z);
+      BZ2_bzCompressEnd(&z->bz);
+    } else BZ2_bzDecompressEnd(&z->bz);
+    break;
+#ifdef SVD_ZSTD
+  case Z_ZSTD:
+    if (z->writing) {
+      zstdFinish(z);
+      ZSTD_freeCCtx(z->zc);
+    } else ZSTD_freeDCtx(z->zd);
+    break;
+#endif
+  }
+  if (z->file && fclose(z->file)) z->failed = TRUE;
+  failed = z->failed;
+  SAFE_FREE(z->buf);
+  free(z);
+  return (failed) ? EOF : 0;
+}
+
+/* Opens fileName compressed by type, returning a stream of its contents,
+   or NULL. */
+static FILE *openZippedFile(const char *fileName, int type, const char *mode) {
+  cookie_io_functions_t io = {zRead, zWrite, NULL, zClose};
+  struct zfile *z = (struct zfile *) calloc(1, sizeof(struct zfile));
+  char writing = (mode[0] != 'r'), gzMode[4] = "rb";
+  FILE *file;
+  if (!z) return NULL;
+  z->type = type;
+  z->writing = writing;
+  if (type == Z_GZIP) {
+    if (writing) sprintf(gzMode, "%cb1", mode[0]);
+    if (!(z->gz = gzopen(fileName, gzMode))) {
+      free(z);
+      return NULL;
+    }
+    gzbuffer(z->gz, Z_BUFFER);
+  } else if (!(z->file = fopen(fileName, mode))) {
+    free(z);
+    return NULL;
+  }
+  switch (type) {
+  case Z_BZIP2:
+    if (!(z->buf = (char *) malloc(Z_BUFFER)) || 
+        ((writing) ? BZ2_bzCompressInit(&z->bz, 1, 0, 0) : 
+         BZ2_bzDecompressInit(&z->bz, 0, 0)) != BZ_OK) z->failed = TRUE;
+    break;
+#ifdef SVD_ZSTD
+  case Z_ZSTD:
+    if (!(z->buf = (char *) malloc(Z_BUFFER))) z->failed = TRUE;
+    else if (writing) {
+      /* Compression is spread over the threads if libzstd supports it. */
+      if (!(z->zc = ZSTD_createCCtx())) z->failed = TRUE;
+      else {
+        ZSTD_CCtx_setParameter(z->zc, ZSTD_c_compressionLevel, 1);
+        ZSTD_CCtx_setParameter(z->zc, ZSTD_c_nbWorkers, svd_threads());
+      }
+    } else if (!(z->zd = ZSTD_createDCtx())) z->failed = TRUE;
+    break;
+#endif
+  }
+  if (z->failed || !(file = fopencookie(z, mode, io))) {
+    if (z->gz) gzclose(z->gz);
+    if (z->file) fclose(z->file);
+    SAFE_FREE(z->buf);
+    free(z);
+    return NULL;
+  }
+  return file;
+}
+
 static FILE *readZippedFile(const char *command, const char *fileName) {
   char buf[MAX_FILENAME];
   sprintf(buf, "%s < %s 2>/dev/null", command, fileName);
@@ -148,10 +757,26 @@ static int stringEndsIn(const char *s, const char *t) {
   return (strcmp(s + ls - lt, t)) ? FALSE : TRUE;
 }
 
+/* The compressed suffixes, in the order they are tried when the file named
+   doesn't exist. */
+enum zippedTypes {NOT_ZIPPED, ZIPPED_ZST, ZIPPED_GZ, ZIPPED_Z, ZIPPED_BZ2};
+static const char *ZipSuffix[] = {".zst", ".gz", ".Z", ".bz2", ".bz", NULL};
+static const int ZipType[] = {ZIPPED_ZST, ZIPPED_GZ, ZIPPED_Z, ZIPPED_BZ2, 
+                              ZIPPED_BZ2};
+
+static int zippedType(const char *fileName) {
+  int i;
+  for (i = 0; ZipSuffix[i]; i++)
+    if (stringEndsIn(fileName, ZipSuffix[i])) return ZipType[i];
+  return NOT_ZIPPED;
+}
+
 /* Will silently return NULL if file couldn't be opened */
 FILE *svd_readFile(const char *fileName) {
   char fileBuf[MAX_FILENAME];
+  const char *suffix;
   struct stat statbuf;
+  int i;
 
   /* Special file name */
   if (!strcmp(fileName, "-"))
@@ -161,50 +786,48 @@ FILE *svd_readFile(const char *fileName) {
   if (fileName[0] == '|')
     return openPipe(fileName + 1, "r");
 
-  /* Check if already ends in .gz or .Z and assume compressed */
-  if (stringEndsIn(fileName, ".gz") || stringEndsIn(fileName, ".Z")) {
-    if (!stat(fileName, &statbuf))
-      return readZippedFile(UNZIP, fileName);
-    return NULL;
-  }
-  /* Check if already ends in .bz or .bz2 and assume compressed */
-  if (stringEndsIn(fileName, ".bz") || stringEndsIn(fileName, ".bz2")) {
+  /* Check if already ends in a compressed suffix */
+  if (!zippedType(fileName)) {
+    /* Try just opening normally */
     if (!stat(fileName, &statbuf))
-      return readZippedFile(BUNZIP2, fileName);
-    return NULL;
-  }
-  /* Try just opening normally */
-  if (!stat(fileName, &statbuf))
-    return fopen(fileName, "r");
-  /* Try adding .gz */
-  sprintf(fileBuf, "%s.gz", fileName);
-  if (!stat(fileBuf, &statbuf))
-    return readZippedFile(UNZIP, fileBuf);
-  /* Try adding .Z */
-  sprintf(fileBuf, "%s.Z", fileName);
-  if (!stat(fileBuf, &statbuf))
-    return readZippedFile(UNZIP, fileBuf);
-  /* Try adding .bz2 */
-  sprintf(fileBuf, "%s.bz2", fileName);
-  if (!stat(fileBuf, &statbuf))
-    return readZippedFile(BUNZIP2, fileBuf);
-  /* Try adding .bz */
-  sprintf(fileBuf, "%s.bz", fileName);
-  if (!stat(fileBuf, &statbuf))
-    return readZippedFile(BUNZIP2, fileBuf);
+      return fopen(fileName, "r");
+    /* Try adding each suffix */
+    for (i = 0; (suffix = ZipSuffix[i]); i++) {
+      sprintf(fileBuf, "%s%s", fileName, suffix);
+      if (!stat(fileBuf, &statbuf)) break;
+    }
+    if (!suffix) return NULL;
+    fileName = fileBuf;
+  } else if (stat(fileName, &statbuf)) return NULL;
 
-  return NULL;
+  switch (zippedType(fileName)) {
+  case ZIPPED_GZ:  return openZippedFile(fileName, Z_GZIP, "r");
+  case ZIPPED_BZ2: return openZippedFile(fileName, Z_BZIP2, "r");
+#ifdef SVD_ZSTD
+  case ZIPPED_ZST: return openZippedFile(fileName, Z_ZSTD, "r");
+#else
+  case ZIPPED_ZST: return readZippedFile(UNZSTD, fileName);
+#endif
+  default:         return readZippedFile(UNZIP, fileName);
+  }
 }
 
 static FILE *writeZippedFile(const char *fileName, char append) {
   char buf[MAX_FILENAME];
-  const char *op = (append) ? ">>" : ">";
-  if (stringEndsIn(fileName, ".bz2") || stringEndsIn(fileName, ".bz"))
-    sprintf(buf, "%s %s \"%s\"", BZIP2, op, fileName);
-  else if (stringEndsIn(fileName, ".Z"))
+  const char *op = (append) ? ">>" : ">", *mode = (append) ? "a" : "w";
+  switch (zippedType(fileName)) {
+  case ZIPPED_GZ:  return openZippedFile(fileName, Z_GZIP, mode);
+  case ZIPPED_BZ2: return openZippedFile(fileName, Z_BZIP2, mode);
+#ifdef SVD_ZSTD
+  case ZIPPED_ZST: return openZippedFile(fileName, Z_ZSTD, mode);
+#else
+  case ZIPPED_ZST: 
+    sprintf(buf, "%s %s \"%s\"", ZSTD, op, fileName);
+    break;
+#endif
+  default:
     sprintf(buf, "%s %s \"%s\"", COMPRESS, op, fileName);
-  else
-    sprintf(buf, "%s %s \"%s\"", ZIP, op, fileName);
+  }
   return openPipe(buf, "w");
 }
 
@@ -217,18 +840,21 @@ FILE *svd_writeFile(const char *fileName, char append) {
   if (fileName[0] == '|')
     return openPipe(fileName + 1, "w");
 
-  /* Check if ends in .gz, .Z, .bz, .bz2 */
-  if (stringEndsIn(fileName, ".gz") || stringEndsIn(fileName, ".Z") ||
-      stringEndsIn(fileName, ".bz") || stringEndsIn(fileName, ".bz2"))
+  /* Check if ends in .zst, .gz, .Z, .bz, .bz2 */
+  if (zippedType(fileName)) 
     return writeZippedFile(fileName, append);
   return (append) ? fopen(fileName, "a") : fopen(fileName, "w");
 }
 
-/* Could be a file or a stream. */
-void svd_closeFile(FILE *file) {
-  if (file == stdin || file == stdout) return;
-  if (isPipe(file)) pclose(file);
-  else fclose(file);
+/* Could be a file or a stream.  A pipe fails if its command does. */
+char svd_closeFile(FILE *file) {
+  if (file == stdin || file == stdout) return fflush(file) != 0;
+  if (isPipe(file)) {
+    if (pclose(file) == 0) return FALSE;
+    svd_error("a piped command failed");
+    return TRUE;
+  }
+  return fclose(file) != 0;
 }
 
 
@@ -270,6 +896,432 @@ char svd_writeBinFloat(FILE *file, float r) {
   return FALSE;
 }
 
+/* Whole arrays are moved through a buffer of this many words, and swapped
+   with a loop the compiler can vectorize. */
+#define BIN_BUFFER (1 << 18)
+
+static void swapWords(uint32_t *w, long n) {
+  long i;
+  if (htonl(1) == 1) return;
+  for (i = 0; i < n; i++) w[i] = ntohl(w[i]);
+}
+
+char svd_readBinWords(FILE *file, uint32_t *w, long n) {
+  if (fread(w, sizeof(uint32_t), n, file) != (size_t) n) return TRUE;
+  swapWords(w, n);
+  return FALSE;
+}
+
+char svd_writeBinWords(FILE *file, uint32_t *w, long n) {
+  swapWords(w, n);
+  return (fwrite(w, sizeof(uint32_t), n, file) != (size_t) n);
+}
+
+static uint32_t *binBuffer(long n) {
+  if (n > BIN_BUFFER) n = BIN_BUFFER;
+  return (uint32_t *) malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+}
+
+char svd_readBinInts(FILE *file, long *a, long n) {
+  uint32_t *w = binBuffer(n);
+  long i, m;
+  if (!w) return TRUE;
+  for (; n > 0; n -= m, a += m) {
+    m = (n < BIN_BUFFER) ? n : BIN_BUFFER;
+    if (svd_readBinWords(file, w, m)) break;
+    for (i = 0; i < m; i++) a[i] = (int32_t) w[i];
+  }
+  free(w);
+  return (n > 0);
+}
+
+char svd_readBinFloats(FILE *file, double *a, long n) {
+  uint32_t *w = binBuffer(n);
+  float *f = (float *) w;
+  long i, m;
+  if (!w) return TRUE;
+  for (; n > 0; n -= m, a += m) {
+    m = (n < BIN_BUFFER) ? n : BIN_BUFFER;
+    if (svd_readBinWords(file, w, m)) break;
+    for (i = 0; i < m; i++) a[i] = f[i];
+  }
+  free(w);
+  return (n > 0);
+}
+
+char svd_writeBinInts(FILE *file, const long *a, long n) {
+  uint32_t *w = binBuffer(n);
+  long i, m;
+  if (!w) return TRUE;
+  for (; n > 0; n -= m, a += m) {
+    m = (n < BIN_BUFFER) ? n : BIN_BUFFER;
+    for (i = 0; i < m; i++) w[i] = (uint32_t) a[i];
+    if (svd_writeBinWords(file, w, m)) break;
+  }
+  free(w);
+  return (n > 0);
+}
+
+char svd_writeBinFloats(FILE *file, const double *a, long n) {
+  uint32_t *w = binBuffer(n);
+  float *f = (float *) w;
+  long i, m;
+  if (!w) return TRUE;
+  for (; n > 0; n -= m, a += m) {
+    m = (n < BIN_BUFFER) ? n : BIN_BUFFER;
+    for (i = 0; i < m; i++) f[i] = (float) a[i];
+    if (svd_writeBinWords(file, w, m)) break;
+  }
+  free(w);
+  return (n > 0);
+}
+
+static void swapWords64(uint64_t *w, long n) {
+  long i;
+  if (htonl(1) == 1) return;
+  for (i = 0; i < n; i++) 
+    w[i] = ((uint64_t) ntohl((uint32_t) w[i]) << 32) | ntohl(w[i] >> 32);
+}
+
+/* Moves n 8-byte words between a and the file through a buffer, with 
+   convert moving each block between the buffer and a, from first on. */
+static char moveWords64(FILE *file, void *a, long n, char writing, 
+                        void (*convert)(uint64_t *w, void *a, long first, 
+                                        long n, char writing)) {
+  uint64_t *w;
+  long m, done = 0;
+  if (!(w = (uint64_t *) malloc(((n < BIN_BUFFER) ? n + 1 : BIN_BUFFER) * 
+                                sizeof(uint64_t)))) return TRUE;
+  for (; done < n; done += m) {
+    m = (n - done < BIN_BUFFER) ? n - done : BIN_BUFFER;
+    if (writing) {
+      convert(w, a, done, m, TRUE);
+      swapWords64(w, m);
+      if (fwrite(w, sizeof(uint64_t), m, file) != (size_t) m) break;
+    } else {
+      if (fread(w, sizeof(uint64_t), m, file) != (size_t) m) break;
+      swapWords64(w, m);
+      convert(w, a, done, m, FALSE);
+    }
+  }
+  free(w);
+  return (done < n);
+}
+
+static void convertLongs(uint64_t *w, void *a, long first, long n, 
+                         char writing) {
+  long i, *l = (long *) a + first;
+  if (writing) for (i = 0; i < n; i++) w[i] = (uint64_t) l[i];
+  else for (i = 0; i < n; i++) l[i] = (long) (int64_t) w[i];
+}
+
+static void convertDoubles(uint64_t *w, void *a, long first, long n, 
+                           char writing) {
+  double *d = (double *) a + first;
+  if (writing) memcpy(w, d, n * sizeof(double));
+  else memcpy(d, w, n * sizeof(double));
+}
+
+char svd_readBinLongs(FILE *file, long *a, long n) {
+  return moveWords64(file, a, n, FALSE, convertLongs);
+}
+
+char svd_readBinDoubles(FILE *file, double *a, long n) {
+  return moveWords64(file, a, n, FALSE, convertDoubles);
+}
+
+char svd_writeBinLongs(FILE *file, const long *a, long n) {
+  return moveWords64(file, (void *) a, n, TRUE, convertLongs);
+}
+
+char svd_writeBinDoubles(FILE *file, const double *a, long n) {
+  return moveWords64(file, (void *) a, n, TRUE, convertDoubles);
+}
+
+/***********************************************************************
+ * Text scanning.  The parsers work on a range of memory, so that they 
+ * can be used both on a buffered stream and on a mapped file.
+ ***********************************************************************/
+
+#define SCAN_BUFFER (1 << 20)
+
+static const double Pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 
+  1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+#define IS_DIGIT(c) ((unsigned) ((c) - '0') < 10)
+
+/* Parses a long at p, which must not be at end.  Returns the end of the 
+   number, or NULL if there isn't one. */
+const char *svd_parseLong(const char *p, const char *end, long *x) {
+  long v = 0;
+  char neg = FALSE;
+  if (*p == '-' || *p == '+') {
+    neg = (*p == '-');
+    if (++p == end) return NULL;
+  }
+  if (!IS_DIGIT(*p)) return NULL;
+  for (; p < end && IS_DIGIT(*p); p++) v = v * 10 + (*p - '0');
+  *x = (neg) ? -v : v;
+  return p;
+}
+
+/* Falls back on strtod for the number at p, which ends at the next space. */
+static const char *parseDoubleSlow(const char *p, const char *end, 
+                                   double *x) {
+  char small[64], *copy = small, *stop;
+  const char *q;
+  long n;
+  for (q = p; q < end && !isspace((unsigned char) *q); q++);
+  n = q - p;
+  if (n >= (long) sizeof(small) && !(copy = (char *) malloc(n + 1))) 
+    return NULL;
+  memcpy(copy, p, n);
+  copy[n] = '\0';
+  *x = strtod(copy, &stop);
+  n = stop - copy;
+  if (copy != small) free(copy);
+  return (n) ? p + n : NULL;
+}
+
+/* Parses a double at p, which must not be at end, giving exactly what 
+   strtod would.  Numbers with at most 15 significant digits and a small 
+   enough exponent are exact in a double, as is the power of ten that 
+   scales them, so a single correctly rounded multiply or divide gives the
+   correctly rounded result (Clinger's fast path).  Anything else goes to
+   strtod.  Returns the end of the number, or NULL if there isn't one. */
+const char *svd_parseDouble(const char *p, const char *end, double *x) {
+  const char *start = p, *q;
+  unsigned long m = 0;
+  long digits = 0, scale = 0, exp = 0;
+  char neg = FALSE, any = FALSE, eneg = FALSE;
+
+  if (*p == '-' || *p == '+') {
+    neg = (*p == '-');
+    p++;
+  }
+  for (; p < end && IS_DIGIT(*p); p++) {
+    any = TRUE;
+    if (m || *p != '0') {
+      if (++digits > 15) return parseDoubleSlow(start, end, x);
+      m = m * 10 + (*p - '0');
+    }
+  }
+  if (p < end && *p == '.') 
+    for (p++; p < end && IS_DIGIT(*p); p++) {
+      any = TRUE;
+      scale--;
+      if (m || *p != '0') {
+        if (++digits > 15) return parseDoubleSlow(start, end, x);
+        m = m * 10 + (*p - '0');
+      }
+    }
+  /* Hex, inf, nan and such. */
+  if (!any || (p < end && ((*p | 0x20) == 'x' || (*p | 0x20) == 'n' ||
+                           (*p | 0x20) == 'i')))
+    return parseDoubleSlow(start, end, x);
+  /* The exponent counts only if it has digits. */
+  if (p < end && (*p | 0x20) == 'e') {
+    q = p + 1;
+    if (q < end && (*q == '-' || *q == '+')) eneg = (*q++ == '-');
+    if (q < end && IS_DIGIT(*q)) {
+      for (; q < end && IS_DIGIT(*q); q++)
+        if (exp < 10000) exp = exp * 10 + (*q - '0');
+      p = q;
+      scale += (eneg) ? -exp : exp;
+    }
+  }
+  if (!m) *x = 0.0;
+  else if (scale < -22 || scale > 22) return parseDoubleSlow(start, end, x);
+  else if (scale < 0) *x = (double) m / Pow10[-scale];
+  else *x = (double) m * Pow10[scale];
+  if (neg) *x = -*x;
+  return p;
+}
+
+/***********************************************************************
+ * Number formatting.  svd_formatDouble gives the same text as printf's 
+ * %.*g, but works out the digits with one long double multiply by an 
+ * exact power of ten.  When that can't be relied on to round correctly, 
+ * it falls back on snprintf.
+ ***********************************************************************/
+
+static const long double Pow10L[] = {
+  1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L, 1e10L, 1e11L, 
+  1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L, 1e20L, 1e21L, 
+  1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L};
+#define MAX_POW10L 27
+
+/* Rounds x > 0 to p significant digits, which are *d * 10^(*e - p + 1)
+   with 10^(p-1) <= *d < 10^p.  Returns TRUE if it can't be sure of 
+   rounding x the way printf would. */
+static char roundDigits(double x, int p, uint64_t *d, int *e) {
+  int e10 = (int) floor(log10(x)), k, tries;
+  long double y, r;
+  for (tries = 0; tries < 3; tries++) {
+    k = p - 1 - e10;
+    if (k > MAX_POW10L || k < -MAX_POW10L) return TRUE;
+    y = (k >= 0) ? x * Pow10L[k] : x / Pow10L[-k];
+    if (y < Pow10L[p - 1]) e10--;
+    else if (y >= Pow10L[p]) e10++;
+    else break;
+  }
+  if (tries == 3) return TRUE;
+  r = floorl(y);
+  /* y is within a rounding error of x * 10^k, so it's only a tie that 
+     can't be settled here. */
+  if (fabsl(y - r - 0.5L) <= y * LDBL_EPSILON * 4) return TRUE;
+  *d = (uint64_t) r + (y - r > 0.5L);
+  if (*d == (uint64_t) Pow10L[p]) {
+    *d /= 10;
+    e10++;
+  }
+  *e = e10;
+  return FALSE;
+}
+
+/* Returns TRUE if d * 10^s reads back as x, -1 if that can't be told
+   here, or FALSE. */
+static int readsBack(double x, uint64_t d, int s) {
+  long double y, gap, err;
+  if (s > MAX_POW10L || s < -MAX_POW10L) return -1;
+  y = (s >= 0) ? d * Pow10L[s] : d / Pow10L[-s];
+  /* Half the distance to the next double on that side. */
+  gap = ((y > x) ? nextafter(x, INFINITY) - x : x - nextafter(x, 0)) / 2;
+  err = y * LDBL_EPSILON * 4;
+  if (fabsl(y - x) < gap - err) return TRUE;
+  if (fabsl(y - x) > gap + err) return FALSE;
+  return -1;
+}
+
+/* Writes d, with p digits and exponent e, as %.*g would. */
+static int printDigits(char *buf, char neg, uint64_t d, int p, int e) {
+  char digits[24], *b = buf;
+  int n, i;
+  for (i = p - 1; i >= 0; i--, d /= 10) digits[i] = '0' + (char) (d % 10);
+  for (n = p; n > 1 && digits[n - 1] == '0'; n--);
+  if (neg) *b++ = '-';
+  if (e < -4 || e >= p) {
+    *b++ = digits[0];
+    if (n > 1) {
+      *b++ = '.';
+      for (i = 1; i < n; i++) *b++ = digits[i];
+    }
+    *b++ = 'e';
+    *b++ = (e < 0) ? '-' : '+';
+    if (e < 0) e = -e;
+    if (e >= 100) *b++ = '0' + e / 100;
+    *b++ = '0' + (e / 10) % 10;
+    *b++ = '0' + e % 10;
+  } else if (e >= 0) {
+    for (i = 0; i <= e; i++) *b++ = (i < n) ? digits[i] : '0';
+    if (n > e + 1) {
+      *b++ = '.';
+      for (; i < n; i++) *b++ = digits[i];
+    }
+  } else {
+    *b++ = '0';
+    *b++ = '.';
+    for (i = -1; i > e; i--) *b++ = '0';
+    for (i = 0; i < n; i++) *b++ = digits[i];
+  }
+  *b = '\0';
+  return b - buf;
+}
+
+/* The shortest text, as %.*g with 15 to 17 digits, that reads back as x.
+   Subnormal numbers have fewer bits, so they may need fewer digits. */
+static int formatShortestSlow(char *buf, double x) {
+  int p, n = 0;
+  for (p = (fabs(x) < DBL_MIN) ? 1 : 15; p <= 17; p++) {
+    n = snprintf(buf, SVD_NUMBER_LEN, "%.*g", p, x);
+    if (strtod(buf, NULL) == x) break;
+  }
+  return n;
+}
+
+int svd_formatDouble(char *buf, double x, int precision) {
+  double ax = fabs(x);
+  uint64_t d;
+  int e, p;
+  if (precision > 17) precision = 17;
+  if (x == 0) return printDigits(buf, signbit(x) != 0, 0, 1, 0);
+  if (!isfinite(x)) return snprintf(buf, SVD_NUMBER_LEN, "%g", x);
+  if (precision > 0) {
+    if (roundDigits(ax, precision, &d, &e)) 
+      return snprintf(buf, SVD_NUMBER_LEN, "%.*g", precision, x);
+    return printDigits(buf, x < 0, d, precision, e);
+  }
+  /* Any x that can be written in 15 digits or fewer comes out that way 
+     with %.15g, once its trailing zeros are dropped. */
+  for (p = 15; p <= 17; p++) {
+    if (roundDigits(ax, p, &d, &e)) return formatShortestSlow(buf, x);
+    if (p == 17) break;
+    switch (readsBack(ax, d, e - p + 1)) {
+    case TRUE: return printDigits(buf, x < 0, d, p, e);
+    case -1: return formatShortestSlow(buf, x);
+    }
+  }
+  return printDigits(buf, x < 0, d, p, e);
+}
+
+struct svd_scan *svd_scanOpen(FILE *file) {
+  struct svd_scan *S = (struct svd_scan *) calloc(1, sizeof(struct svd_scan));
+  if (!S || !(S->buf = (char *) malloc(SCAN_BUFFER))) {
+    SAFE_FREE(S);
+    svd_error("svd_scanOpen: failed to allocate buffer");
+    return NULL;
+  }
+  S->file = file;
+  return S;
+}
+
+void svd_scanClose(struct svd_scan *S) {
+  if (!S) return;
+  SAFE_FREE(S->buf);
+  free(S);
+}
+
+/* Moves to the start of the next token and makes sure all of it is in the
+   buffer.  Returns TRUE if there are no more tokens. */
+static char scanToken(struct svd_scan *S) {
+  long i;
+  for (;;) {
+    while (S->pos < S->len && isspace((unsigned char) S->buf[S->pos])) 
+      S->pos++;
+    if (S->pos < S->len) {
+      for (i = S->pos; i < S->len && !isspace((unsigned char) S->buf[i]); 
+           i++);
+      if (i < S->len || S->eof) return FALSE;
+    } else if (S->eof) return TRUE;
+    /* Keep the partial token and read more. */
+    if (S->pos == 0 && S->len == SCAN_BUFFER) return FALSE;
+    memmove(S->buf, S->buf + S->pos, S->len - S->pos);
+    S->len -= S->pos;
+    S->pos = 0;
+    S->len += fread(S->buf + S->len, 1, SCAN_BUFFER - S->len, S->file);
+    if (S->len < SCAN_BUFFER) S->eof = TRUE;
+  }
+}
+
+char svd_scanLong(struct svd_scan *S, long *x) {
+  const char *end;
+  if (scanToken(S)) return TRUE;
+  if (!(end = svd_parseLong(S->buf + S->pos, S->buf + S->len, x))) 
+    return TRUE;
+  S->pos = end - S->buf;
+  return FALSE;
+}
+
+char svd_scanDouble(struct svd_scan *S, double *x) {
+  const char *end;
+  if (scanToken(S)) return TRUE;
+  if (!(end = svd_parseDouble(S->buf + S->pos, S->buf + S->len, x))) 
+    return TRUE;
+  S->pos = end - S->buf;
+  return FALSE;
+}
+
 /************************************************************** 
  * function scales a vector by a constant.	     	      *
  * Based on Fortran-77 routine from Linpack by J. Dongarra    *
@@ -320,6 +1372,44 @@ void svd_dsort2(long igap, long n, double *array1, double *array2) {
   svd_dsort2(igap/2,n,array1,array2);
 }
 
+/* Matrices with fewer entries than this are multiplied on one thread. */
+#define PARALLEL_MXV_MIN (1 << 16)
+
+struct gather {
+  SMat A;
+  double *x, *y;
+  long col[MAX_STRIPS + 1];
+};
+
+static void gatherStrip(long k, int thread, void *arg) {
+  struct gather *G = (struct gather *) arg;
+  long i, j, end, *pointr = G->A->pointr, *rowind = G->A->rowind;
+  double *value = G->A->value, *x = G->x, t;
+  for (i = G->col[k]; i < G->col[k+1]; i++) {
+    end = pointr[i+1];
+    for (t = 0.0, j = pointr[i]; j < end; j++)
+      t += value[j] * x[rowind[j]];
+    G->y[i] = t;
+  }
+}
+
+/* Sets y = A'x.  Each column's sum is independent of the others, so on a 
+   large matrix the strips of svd_columnStrips are summed on the thread 
+   pool, each on the thread whose node holds it under SVD_NUMA_PARTITION,
+   with the same result as summing them in turn. */
+static void gather(SMat A, double *x, double *y) {
+  struct gather G;
+  int parts = 1;
+  G.A = A;
+  G.x = x;
+  G.y = y;
+  G.col[0] = 0;
+  G.col[1] = A->cols;
+  if (A->vals >= PARALLEL_MXV_MIN) parts = svd_columnStrips(A, G.col);
+  if (parts > 1) svd_parallelFixed(parts, gatherStrip, &G);
+  else gatherStrip(0, 0, &G);
+}
+
 /**************************************************************
  * multiplication of matrix B by vector x, where B = A'A,     *
  * and A is nrow by ncol (nrow >> ncol). Hence, B is of order *
@@ -329,10 +1419,8 @@ void svd_opb(SMat A, double *x, double *y, double *temp) {
   long i, j, end;
   long *pointr = A->pointr, *rowind = A->rowind;
   double *value = A->value;
-  long n = A->cols;
 
   SVDCount[SVD_MXV] += 2;
-  memset(y, 0, n * sizeof(double));
   memset(temp, 0, (A->rows) * sizeof(double));
   //for (i = 0; i < A->rows; i++) temp[i] = 0.0;
 
@@ -343,13 +1431,7 @@ void svd_opb(SMat A, double *x, double *y, double *temp) {
     x++;
   }
 
-  for (i = 0; i < A->cols; i++) {
-    end = pointr[i+1];
-    for (j = pointr[i]; j < end; j++) 
-      *y += value[j] * temp[rowind[j]];
-    y++;
-  }
-
+  gather(A, temp, y);
   return;
 }
 
@@ -374,6 +1456,16 @@ void svd_opa(SMat A, double *x, double *y) {
   return;
 }
 
+/***********************************************************
+ * multiplication of the transpose of matrix A by vector x,*
+ * where A is nrow by ncol.  y stores product vector.      *
+ ***********************************************************/
+void svd_opat(SMat A, double *x, double *y) {
+  SVDCount[SVD_MXV]++;
+  gather(A, x, y);
+  return;
+}
+
 
 /***********************************************************************
  *                                                                     *
@@ -405,25 +1497,28 @@ void svd_opa(SMat A, double *x, double *y) {
    random  a double precision random number between (0,1)
 
  ***********************************************************************/
-double svd_random2(long *iy) {
-   static long m2 = 0;
-   static long ia, ic, mic;
-   static double halfm, s;
+static long m2, ia, ic, mic;
+static double halfm, scale;
+static pthread_once_t randomOnce = PTHREAD_ONCE_INIT;
+
+static void random2Init(void) {
+   /* compute (max int) / 2 */
+   m2 = 1 << (8 * (int)sizeof(int) - 2); 
+   halfm = m2;
 
-   /* If first entry, compute (max int) / 2 */
-   if (!m2) {
-      m2 = 1 << (8 * (int)sizeof(int) - 2); 
-      halfm = m2;
+   /* compute multiplier and increment for linear congruential 
+    * method */
+   ia = 8 * (long)(halfm * atan(1.0) / 8.0) + 5;
+   ic = 2 * (long)(halfm * (0.5 - sqrt(3.0)/6.0)) + 1;
+   mic = (m2-ic) + m2;
 
-      /* compute multiplier and increment for linear congruential 
-       * method */
-      ia = 8 * (long)(halfm * atan(1.0) / 8.0) + 5;
-      ic = 2 * (long)(halfm * (0.5 - sqrt(3.0)/6.0)) + 1;
-      mic = (m2-ic) + m2;
+   /* scale is the factor for converting to floating point */
+   scale = 0.5 / halfm;
+}
 
-      /* s is the scale factor for converting to floating point */
-      s = 0.5 / halfm;
-   }
+double svd_random2(long *iy) {
+   /* If first entry, compute the constants */
+   pthread_once(&randomOnce, random2Init);
 
    /* compute next random number */
    *iy = *iy * ia;
@@ -440,6 +1535,6 @@ double svd_random2(long *iy) {
    /* for computers whose integer overflow affects the sign bit */
    if (*iy < 0) *iy = (*iy + m2) + m2;
 
-   return((double)(*iy) * s);
+   return((double)(*iy) * scale);
 }
 
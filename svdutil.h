@@ -37,6 +37,7 @@ extern "C" {
 #endif
 
 #include <math.h>
+#include <stdint.h>
 #include "svdlib.h"
 
 #define SAFE_FREE(a) {if (a) {free(a); a = NULL;}}
@@ -46,19 +47,129 @@ extern long *svd_longArray(long size, char empty, char *name);
 /* Allocates an array of doubles. */
 extern double *svd_doubleArray(long size, char empty, char *name);
 
+/* Arrays carved from a workspace start on SVD_ALIGN byte boundaries, a 
+   cache line, so that vector loads of them are aligned. */
+#define SVD_ALIGN 64
+#define SVD_ALIGNED(bytes) (((bytes) + SVD_ALIGN - 1) & ~(long) (SVD_ALIGN - 1))
+
+struct svdworkspace {
+  char *base;    /* The block, aligned to SVD_ALIGN bytes. */
+  long size;     /* Bytes in the block. */
+  long used;     /* Bytes carved so far. */
+  void *map;     /* If the block was mapped for huge pages, the mapping. */
+  long mapSize;
+};
+
+/* Makes W hold at least bytes, keeping its block if that is big enough, 
+   and empties it.  Returns TRUE on failure. */
+extern char svd_reserve(SVDWorkspace W, long bytes);
+/* Carves the next array of doubles from W, zeroed if empty is set.  The 
+   arrays are given back all at once by the next svd_reserve. */
+extern double *svd_carve(SVDWorkspace W, long size, char empty, char *name);
+/* Frees W's block. */
+extern void svd_release(SVDWorkspace W);
+
 extern void svd_debug(const char *fmt, ...);
 extern void svd_error(const char *fmt, ...);
 extern void svd_fatalError(const char *fmt, ...);
 extern FILE *svd_fatalReadFile(const char *filename);
 extern FILE *svd_readFile(const char *fileName);
 extern FILE *svd_writeFile(const char *fileName, char append);
-extern void svd_closeFile(FILE *file);
+/* Closes a file opened by the above, returning TRUE if anything written 
+   to it could not be flushed, or if it was a pipe and its command 
+   failed. */
+extern char svd_closeFile(FILE *file);
+
+/* Set by svdLAS2Batch on each thread while it runs svdLAS2 there, to turn
+   off the reports, checkpointing, SVDProgress and SVDOutput for that run
+   only. */
+extern __thread char SVDBatchRun;
+
+/* Number of threads svd_parallel() will use. */
+extern int svd_threads(void);
+/* Calls task(i, thread, arg) for each i in 0..tasks-1, spread over the thread
+   pool.  thread is the index (below svd_threads()) of the thread running the
+   task, for use with per-thread scratch space.  Runs serially when called 
+   from inside another parallel task. */
+extern void svd_parallel(long tasks, void (*task)(long i, int thread, void *arg),
+                         void *arg);
+
+/* Like svd_parallel, but runs task i on thread i modulo the number of 
+   threads, so that work on the same data always lands on the same thread. */
+extern void svd_parallelFixed(long tasks, 
+                              void (*task)(long i, int thread, void *arg),
+                              void *arg);
+
+/* Number of NUMA nodes with memory, or 1 if there is just one or the 
+   system doesn't say. */
+extern int svd_numaNodes(void);
+/* The node (counting from 0) pool thread runs on under SVD_NUMA_PARTITION. */
+extern int svd_threadNode(int thread);
+/* Advises that the whole pages in bytes from p go on node, or are 
+   interleaved over all nodes if node is negative, moving any already in 
+   use. */
+extern void svd_numaPlace(void *p, long bytes, int node);
+/* Places an array of parts strips of elements width bytes wide, strip k 
+   running from element bound[k] to bound[k+1] (with p at bound[0]), under 
+   SVDNumaPolicy: interleaved, or strip k on the node of thread k. */
+extern void svd_numaSpread(void *p, long width, const long *bound, int parts);
+
+/* The most strips svd_columnStrips makes. */
+#define MAX_STRIPS 256
+/* Splits the columns of A into one strip per thread, with about equal 
+   numbers of entries; strip k has columns col[k] to col[k+1] - 1.  Returns 
+   the number of strips. */
+extern int svd_columnStrips(SMat A, long *col);
+/* Places the arrays of A under SVDNumaPolicy, in the strips of 
+   svd_columnStrips. */
+extern void svd_numaPlaceMatrix(SMat A);
 
 extern char svd_readBinInt(FILE *file, int *val);
 extern char svd_readBinFloat(FILE *file, float *val);
 extern char svd_writeBinInt(FILE *file, int x);
 extern char svd_writeBinFloat(FILE *file, float r);
 
+/* Reads or writes n 4-byte words in network order, converting them in
+   place from or to host order.  These return TRUE on failure, and the 
+   writer leaves w in network order. */
+extern char svd_readBinWords(FILE *file, uint32_t *w, long n);
+extern char svd_writeBinWords(FILE *file, uint32_t *w, long n);
+/* Read or write whole arrays of ints or floats in the binary formats. */
+extern char svd_readBinInts(FILE *file, long *a, long n);
+extern char svd_readBinFloats(FILE *file, double *a, long n);
+extern char svd_writeBinInts(FILE *file, const long *a, long n);
+extern char svd_writeBinFloats(FILE *file, const double *a, long n);
+/* The same for arrays of 8-byte ints and doubles. */
+extern char svd_readBinLongs(FILE *file, long *a, long n);
+extern char svd_readBinDoubles(FILE *file, double *a, long n);
+extern char svd_writeBinLongs(FILE *file, const long *a, long n);
+extern char svd_writeBinDoubles(FILE *file, const double *a, long n);
+
+/* Reads whitespace-separated numbers from a text stream through a large 
+   buffer, much faster than fscanf but with the same results. */
+struct svd_scan {
+  FILE *file;
+  char *buf;
+  long pos, len;
+  char eof;
+};
+extern struct svd_scan *svd_scanOpen(FILE *file);
+extern void svd_scanClose(struct svd_scan *S);
+/* These return TRUE if there is no number to read. */
+extern char svd_scanLong(struct svd_scan *S, long *x);
+extern char svd_scanDouble(struct svd_scan *S, double *x);
+/* Parse the number at p, before end, as strtol and strtod would.  Return 
+   the end of the number, or NULL if there isn't one. */
+extern const char *svd_parseLong(const char *p, const char *end, long *x);
+extern const char *svd_parseDouble(const char *p, const char *end, double *x);
+
+/* Longest text svd_formatDouble writes, with the terminating null. */
+#define SVD_NUMBER_LEN 32
+/* Writes x into buf as printf's %.*g would with this many significant 
+   digits, up to 17.  With precision 0, it uses the fewest digits that 
+   read back as exactly x.  Returns the length. */
+extern int svd_formatDouble(char *buf, double x, int precision);
+
 /************************************************************** 
  * returns |a| if b is positive; else fsign returns -|a|      *
  **************************************************************/ 
@@ -161,6 +272,12 @@ extern void svd_opb(SMat A, double *x, double *y, double *temp);
  ***********************************************************/
 extern void svd_opa(SMat A, double *x, double *y);
 
+/***********************************************************
+ * multiplication of the transpose of matrix A by vector x,*
+ * where A is nrow by ncol.  y stores product vector.      *
+ ***********************************************************/
+extern void svd_opat(SMat A, double *x, double *y);
+
 /***********************************************************************
  *                                                                     *
  *				random2()                              *